@@ -7,6 +7,8 @@
 #include <Unet/Service.h>
 #include <Unet/MultiCallback.h>
 #include <Unet/NetworkMessage.h>
+#include <Unet/MessagePool.h>
+#include <Unet/MessageQueue.h>
 #include <Unet/Reassembly.h>
 #include <Unet/IContext.h>
 
@@ -19,6 +21,7 @@ namespace Unet
 			friend class ::Unet::Lobby;
 			friend class ::Unet::LobbyMember;
 			friend struct ::Unet::LobbyListResult;
+			friend class ::Unet::Reassembly;
 
 		public:
 			Context(int numChannels = 1);
@@ -34,6 +37,9 @@ namespace Unet
 			virtual void SetPrimaryService(ServiceType service) override;
 			virtual ServiceType GetPrimaryService() override;
 
+			virtual void SetInternalMessageCoalescing(bool enabled) override;
+			virtual void SetChannelCoalescing(int channel, bool enabled) override;
+
 			virtual Service* EnableService(ServiceType service) override;
 			virtual int ServiceCount() override;
 			virtual void SimulateServiceOutage(ServiceType service) override;
@@ -62,12 +68,21 @@ namespace Unet
 
 			virtual void RequestFile(LobbyMember* member, const char* filename) override;
 			virtual void RequestFile(LobbyMember* member, LobbyFile* file) override;
+			virtual void SetFileBandwidthLimit(size_t bytesPerSecond) override;
 
 			virtual void SendChat(const char* message) override;
 
 			virtual bool IsMessageAvailable(int channel) override;
 			virtual NetworkMessageRef ReadMessage(int channel) override;
+			virtual void SetChannelQueuePolicy(int channel, QueuePolicy policy, size_t maxMessages = 0) override;
+			virtual size_t GetDroppedMessages(int channel) override;
+			virtual const MessagePoolStats &GetMessagePoolStats() override;
+			virtual std::vector<RelayRouteStats> GetRelayStats() override;
+
+			virtual void SetCompressionDictionary(const uint8_t* data, size_t size) override;
+			virtual DictionaryCodec &GetDictionaryCodec() override;
 
+			void SendTo_Split(LobbyMember* member, uint8_t* data, size_t size, PacketType type, uint8_t channel);
 			void SendTo_Impl(LobbyMember* member, uint8_t* data, size_t size, PacketType type = PacketType::Reliable, uint8_t channel = 0);
 			virtual void SendTo(LobbyMember* member, uint8_t* data, size_t size, PacketType type = PacketType::Reliable, uint8_t channel = 0) override;
 			virtual void SendToAll(uint8_t* data, size_t size, PacketType type = PacketType::Reliable, uint8_t channel = 0) override;
@@ -75,6 +90,8 @@ namespace Unet
 			virtual void SendToHost(uint8_t* data, size_t size, PacketType type = PacketType::Reliable, uint8_t channel = 0) override;
 
 		private:
+			void SendToMany(const std::vector<LobbyMember*> &members, uint8_t* data, size_t size, PacketType type, uint8_t channel);
+
 			Service* PrimaryService();
 			Service* GetService(ServiceType type);
 
@@ -84,6 +101,55 @@ namespace Unet
 			void InternalSendToAll(const json &js, uint8_t* binaryData = nullptr, size_t binarySize = 0);
 			void InternalSendToAllExcept(LobbyMember* exceptMember, const json &js, uint8_t* binaryData = nullptr, size_t binarySize = 0);
 			void InternalSendToHost(const json &js, uint8_t* binaryData = nullptr, size_t binarySize = 0);
+			void InternalSendToMany(const std::vector<LobbyMember*> &members, const json &js, uint8_t* binaryData = nullptr, size_t binarySize = 0);
+			// Sends an internal message on the file channel instead of the internal lobby message channel
+			void InternalSendFileData(LobbyMember* member, const json &js, uint8_t* binaryData, size_t binarySize);
+
+		private:
+			struct PendingInternalMessages
+			{
+				// Each message is prefixed with its size as a 32 bit unsigned integer
+				std::vector<uint8_t> Data;
+				int Count = 0;
+			};
+			typedef std::unordered_map<ServiceID, PendingInternalMessages>::iterator PendingInternalIterator;
+
+			struct PendingChannelMessages
+			{
+				// Each message is prefixed with its size as a 32 bit unsigned integer
+				std::vector<uint8_t> Data;
+				int Count = 0;
+				// The packet type the whole batch is sent with
+				PacketType Type = PacketType::Unreliable;
+			};
+
+			// Every packet on a user channel ends with one of these, so the receiver can tell batches apart from
+			// single messages without knowing how the sender configured the channel
+			enum class ChannelFrame : uint8_t
+			{
+				Message,
+				Batch,
+			};
+
+			size_t PackInternalMessage(const json &js, uint8_t* binaryData, size_t binarySize);
+			void InternalSendPacked(Service* service, const std::vector<ServiceID> &ids, uint8_t* data, size_t size, uint8_t channel = 0);
+
+			void QueueInternalMessage(const ServiceID &id, uint8_t* data, size_t size);
+			void FlushInternalMessages(const ServiceID &id);
+			void FlushInternalMessages(PendingInternalIterator it);
+			void FlushInternalMessages();
+
+			void FlushLatestOnlyMessages();
+
+			// Copies the message into m_frameBuffer with the frame byte appended, and returns the framed size
+			size_t PrepareChannelFrame(uint8_t* data, size_t size, ChannelFrame frame);
+
+			void QueueChannelMessage(LobbyMember* member, uint8_t* data, size_t size, PacketType type, uint8_t channel);
+			void FlushChannelMessages(uint32_t key, PendingChannelMessages &pending);
+			void FlushChannelMessages();
+
+			void QueueMessage(NetworkMessage* msg);
+			void QueueServiceMessages(int channel);
 
 		private:
 			void OnLobbyCreated(const CreateLobbyResult &result);
@@ -96,6 +162,9 @@ namespace Unet
 			void PrepareReceiveBuffer(size_t size);
 			void PrepareSendBuffer(size_t size);
 
+			void HandleRelayMessage(Service* service, NetworkMessage* msg);
+			RelayRouteStats &GetRelayRoute(int fromPeer, int toPeer);
+
 		private:
 			std::string m_personaName;
 
@@ -112,12 +181,40 @@ namespace Unet
 
 			std::vector<Service*> m_services;
 
-			std::vector<std::queue<NetworkMessage*>> m_queuedMessages;
+			MessagePool m_messagePool;
+
+			std::vector<MessageQueue> m_queuedMessages;
 			Reassembly m_reassembly;
 
 			std::vector<uint8_t> m_receiveBuffer;
 			std::vector<uint8_t> m_sendBuffer;
 
+			bool m_coalesceInternalMessages = false;
+			std::unordered_map<ServiceID, PendingInternalMessages> m_pendingInternalMessages;
+
+			// Keyed by the sender peer in the high byte and the recipient peer in the low byte
+			std::unordered_map<uint16_t, RelayRouteStats> m_relayStats;
+
+			// The last message sent with PacketType::LatestOnly this tick, keyed by the recipient peer in the high bits
+			// and the channel in the low byte
+			std::unordered_map<uint32_t, std::vector<uint8_t>> m_latestOnlyMessages;
+
+			// Coalesced channel messages, keyed by the recipient peer in the high bits and the channel in the low byte.
+			// A batch is flushed early once it would grow beyond CoalescedBatchSize, or when a message of another
+			// packet type is sent to the same peer and channel.
+			static const size_t CoalescedBatchSize = 1200;
+			std::vector<bool> m_coalescedChannels;
+			std::unordered_map<uint32_t, PendingChannelMessages> m_pendingChannelMessages;
+			std::vector<uint8_t> m_frameBuffer;
+
+			DictionaryCodec m_dictionaryCodec;
+
+			// Channel that file data is reassembled on, next to -1 for internal lobby messages
+			static const int FileReassemblyChannel = -2;
+
+			// Bytes per second of file data sent to all members combined, 0 if there's no limit
+			size_t m_fileBandwidthLimit = 0;
+
 		public:
 			MultiCallback<CreateLobbyResult> m_callbackCreateLobby;
 			MultiCallback<LobbyListResult> m_callbackLobbyList;
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <Unet_common.h>
+
+namespace Unet
+{
+	// A small LZ77 codec that can refer back into a preset dictionary. Packets that are serialized from the same
+	// kind of data every tick share most of their bytes with a dictionary built from earlier packets, so even
+	// tiny packets compress well, which a generic per-packet compressor can't do.
+	class DictionaryCodec
+	{
+	public:
+		// Matches can refer back at most 64 KB, so anything before that in the dictionary would be unused
+		static const size_t MaxDictionarySize = 0xFFFF;
+
+	private:
+		std::vector<uint8_t> m_dictionary;
+		uint32_t m_dictionaryHash = 0;
+
+		// Position of the last occurence of every hashed 4 byte sequence in the dictionary, plus one
+		std::vector<uint32_t> m_dictionaryTable;
+		// Same as above for the input that is being compressed, reset for every call to Compress
+		std::vector<uint32_t> m_inputTable;
+
+	public:
+		// Sets the dictionary. If it's bigger than MaxDictionarySize, only the end of it is used.
+		void SetDictionary(const uint8_t* data, size_t size);
+		const std::vector<uint8_t> &GetDictionary() const;
+		uint32_t GetDictionaryHash() const;
+		bool HasDictionary() const;
+
+		// Compresses the data into out, replacing its contents. Returns false if the compressed data would not be
+		// smaller than the input, in which case the contents of out are undefined.
+		bool Compress(const uint8_t* data, size_t size, std::vector<uint8_t> &out);
+		// Decompresses data created by Compress with the same dictionary into out, replacing its contents.
+		// Returns false if the data is malformed.
+		bool Decompress(const uint8_t* data, size_t size, std::vector<uint8_t> &out) const;
+	};
+}
@@ -2,6 +2,9 @@
 
 #include <Unet_common.h>
 #include <Unet/NetworkMessage.h>
+#include <Unet/MessageQueue.h>
+#include <Unet/RelayStats.h>
+#include <Unet/DictionaryCodec.h>
 #include <Unet/LobbyMember.h>
 #include <Unet/LobbyListFilter.h>
 
@@ -45,6 +48,19 @@ namespace Unet
 		// Gets the currently set primary service.
 		virtual ServiceType GetPrimaryService() = 0;
 
+		// When enabled, internal lobby messages (lobby data, member info, chat, etc.) are not sent immediately,
+		// but collected and sent as a single packet per peer at the end of RunCallbacks. Messages carrying binary
+		// data, such as file data, are never held back.
+		virtual void SetInternalMessageCoalescing(bool enabled) = 0;
+
+		// When enabled, messages sent on the given channel are packed together per peer, and sent as datagrams of up
+		// to 1200 bytes at the end of RunCallbacks. Messages keep their order, so a batch ends early when the packet
+		// type changes. Batches are marked as such, so this only has to be enabled on the sending side.
+		// Services are flushed right after, so the only latency this adds is the time between the send and the end
+		// of the RunCallbacks call that follows it, which is at most one frame when RunCallbacks is called once per
+		// frame after the game logic.
+		virtual void SetChannelCoalescing(int channel, bool enabled) = 0;
+
 		// Enable a service.
 		virtual Service* EnableService(ServiceType service) = 0;
 
@@ -132,6 +148,10 @@ namespace Unet
 		// between server and client.
 		virtual void RequestFile(LobbyMember* member, LobbyFile* file) = 0;
 
+		// Limits how fast file data is sent to all members combined, in bytes per second. 0 means no limit, in
+		// which case file data is only paced by how much each connection can take without delaying other traffic.
+		virtual void SetFileBandwidthLimit(size_t bytesPerSecond) = 0;
+
 		// Sends a chat message to the lobby. This will also immediately trigger OnLobbyChat in the callbacks
 		// for the local chat message.
 		virtual void SendChat(const char* message) = 0;
@@ -139,9 +159,34 @@ namespace Unet
 		// Checks if a message is available on the given channel.
 		virtual bool IsMessageAvailable(int channel) = 0;
 
-		// Reads the next available message from the given channel.
+		// Reads the next available message from the given channel. The message is returned to the context's
+		// message pool once the reference is destroyed, so it must not outlive the context.
 		virtual NetworkMessageRef ReadMessage(int channel) = 0;
 
+		// Sets how received messages wait on the given channel until they're read. For QueuePolicy::DropOldest,
+		// maxMessages is the amount of messages that are kept. Useful to avoid catching up on stale messages
+		// after a hitch.
+		virtual void SetChannelQueuePolicy(int channel, QueuePolicy policy, size_t maxMessages = 0) = 0;
+		// Gets the amount of messages that the queue policy of the channel has dropped so far.
+		virtual size_t GetDroppedMessages(int channel) = 0;
+
+		// Gets allocation counters of the message pool. In a steady state, MessageAllocs and BlockAllocs should
+		// stop growing, as all messages are recycled.
+		virtual const MessagePoolStats &GetMessagePoolStats() = 0;
+
+		// Gets counters for every route of packets that were relayed through the host. On the host, these are the
+		// packets that were forwarded. On clients, these are the packets that were sent to the host to be relayed.
+		virtual std::vector<RelayRouteStats> GetRelayStats() = 0;
+
+		// Sets the dictionary used to compress channel payloads, typically a concatenation of packets that are
+		// representative of the game's traffic. When hosting, the dictionary is sent to all members, and members
+		// that join later receive it with the lobby info. Clients receiving a dictionary from the host replace
+		// their own.
+		virtual void SetCompressionDictionary(const uint8_t* data, size_t size) = 0;
+
+		// Gets the codec that compresses with the current dictionary, which must be the same on both sides.
+		virtual DictionaryCodec &GetDictionaryCodec() = 0;
+
 		// Send a message to the given lobby member. The service to send the message on is automatically
 		// picked from the best possible option. If there is no direct connection possible to this player,
 		// it will be relayed through the host.
@@ -157,7 +202,7 @@ namespace Unet
 		// Unreliable packets should not be bigger than 1198 bytes. Unreliable packets are always sent
 		// unsequenced, and as such don't allow for bigger sizes than MTU. While MTU may be 1200 bytes,
 		// we have to account for the possibility of sending relay-packet header data, so having a safety
-		// margin of at least 2 bytes is recommended.
+		// margin of at least 3 bytes is recommended.
 		//
 		// The channel you send data on is an index starting at 0. You must have created the context with
 		// a sufficient number of channels if you wish to use multiple channels.
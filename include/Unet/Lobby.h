@@ -16,7 +16,31 @@ namespace Unet
 		LobbyInfo m_info;
 
 		std::vector<LobbyMember*> m_members;
+
+		// Lookup indices into m_members, kept in sync by InsertMember, EraseMember and the member service functions
+		std::unordered_map<xg::Guid, LobbyMember*> m_membersByGuid;
+		std::unordered_map<int, LobbyMember*> m_membersByPeer;
+		std::unordered_map<ServiceID, LobbyMember*> m_membersByServiceID;
 		std::vector<OutgoingFileTransfer> m_outgoingFileTransfers;
+		std::vector<IncomingFileTransfer> m_incomingFileTransfers;
+
+		// Keeps track of how fast the connection to a member takes data, to pace the file data sent to them
+		struct FileSendPacing
+		{
+			size_t LastPending = 0;
+			size_t Sent = 0;
+			// Bytes per second the connection delivered, smoothed over multiple ticks
+			double Rate = 0.0;
+			std::chrono::steady_clock::time_point LastCheck;
+		};
+		std::unordered_map<int, FileSendPacing> m_fileSendPacing;
+		// Bytes of file data that can still be sent under the bandwidth limit
+		double m_fileSendBudget = 0.0;
+		std::chrono::steady_clock::time_point m_lastFileSend;
+		// Scratch space for the file block that's currently being sent
+		std::vector<uint8_t> m_fileBlock;
+
+		bool m_namePending = false;
 
 	private:
 		Lobby(Internal::Context* ctx, const LobbyInfo &lobbyInfo);
@@ -34,7 +58,8 @@ namespace Unet
 		LobbyMember* GetMember(const ServiceID &serviceId);
 		LobbyMember* GetHostMember();
 
-		void HandleMessage(const ServiceID &peer, uint8_t* data, size_t size);
+		// inBatch is set for the messages inside of a batch, which can't be batches themselves
+		void HandleMessage(const ServiceID &peer, uint8_t* data, size_t size, bool inBatch = false);
 		LobbyMember* DeserializeMember(const json &member);
 
 		void AddEntryPoint(const ServiceID &id);
@@ -58,6 +83,29 @@ namespace Unet
 	private:
 		int GetNextAvailablePeer();
 
+		// Adds a member to the member list and the lookup indices
+		void InsertMember(LobbyMember* member);
+		// Removes a member from the member list and the lookup indices, without deleting it
+		void EraseMember(LobbyMember* member);
+		// Updates the peer index after the member's peer has changed
+		void ReindexMemberPeer(LobbyMember* member, int oldPeer);
+
 		void HandleOutgoingFileTransfers();
+		// Gets how many bytes of file data can be sent to the member this tick without queueing up more data than
+		// their connection delivers in a round trip plus a bit
+		size_t GetFileSendAllowance(LobbyMember* member, std::chrono::steady_clock::time_point now);
+
+		// Starts downloading the file from every member that has a file with the same hash
+		void StartIncomingFileTransfer(LobbyMember* member, LobbyFile* file);
+		IncomingFileTransfer* GetIncomingFileTransfer(uint64_t hash);
+		// Keeps track of which members can provide the files we're downloading, and gives them new batches of chunks
+		void HandleIncomingFileTransfers();
+		// Whether the member has a file with the hash and can be downloaded from directly
+		bool IsFileSource(LobbyMember* member, uint64_t hash);
+		// Ends the current batch of a source, so the chunks it didn't deliver can be requested again
+		void EndIncomingFileBatch(IncomingFileTransfer &transfer, IncomingFileTransfer::Source &source, LobbyFile* file);
+
+		// Sends out all batched lobby and member data changes as a single packet
+		void FlushDataChanges();
 	};
 }
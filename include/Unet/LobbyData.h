@@ -13,6 +13,12 @@ namespace Unet
 		LobbyData(const std::string &name, const std::string &value);
 	};
 
+	struct LobbyDataChange
+	{
+		bool Removed = false;
+		std::string Value;
+	};
+
 	class LobbyDataContainer
 	{
 		friend class Lobby;
@@ -20,6 +26,11 @@ namespace Unet
 	public:
 		std::vector<LobbyData> m_data;
 
+	protected:
+		// Changes that haven't been sent yet while batching, repeated changes to the same key collapse into one
+		std::map<std::string, LobbyDataChange> m_pendingChanges;
+		bool m_batchData = false;
+
 	public:
 		virtual void SetData(const std::string &name, const std::string &value);
 		virtual std::string GetData(const std::string &name) const;
@@ -28,8 +39,22 @@ namespace Unet
 		virtual json SerializeData() const;
 		virtual void DeserializeData(const json &js);
 
+		// While batching is enabled, data changes are applied locally right away, but they are only sent out
+		// as a single delta packet per peer at the end of RunCallbacks.
+		void SetDataBatching(bool enabled);
+		bool IsDataBatching() const;
+		bool HasPendingDataChanges() const;
+
 	protected:
 		void InternalSetData(const std::string &name, const std::string &value);
 		void InternalRemoveData(const std::string &name);
+
+		void RecordDataChange(const std::string &name, const std::string &value, bool removed);
+
+		// Serializes the pending changes as a delta object with "set" and "remove" keys, and clears them
+		json SerializeDataChanges();
+		// Applies a delta object created with SerializeDataChanges, and returns the names of all changed keys. If
+		// record is true, the changes are also recorded to be sent out again with the next flush.
+		std::vector<std::string> ApplyDataChanges(const json &js, bool record = false);
 	};
 }
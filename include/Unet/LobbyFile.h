@@ -8,41 +8,117 @@ namespace Unet
 	class LobbyFile
 	{
 	public:
+		// Files are transferred and verified in chunks of this size
+		static const size_t ChunkSize = 1024 * 64;
+		// Amount of batches a member can leave incomplete before they're no longer downloaded from
+		static const int MaxRetries = 3;
+
 		std::string m_filename;
 		uint64_t m_hash = 0;
+		// Hash of every chunk, as announced by the member sharing the file. Can be empty if they didn't send any,
+		// in which case only the hash of the entire file is checked.
+		std::vector<uint64_t> m_chunkHashes;
 
+		// Only set for files loaded from memory, files on disk are read in blocks when needed
 		uint8_t* m_buffer = nullptr;
 		size_t m_size = 0;
 		size_t m_availableSize = 0;
 
+	private:
+		// The file on disk backing this file, either the original file, the cache file, or the partial cache file
+		// that incoming data is written to
+		std::string m_path;
+		mutable FILE* m_handle = nullptr;
+		bool m_partial = false;
+
+		std::vector<bool> m_chunksAvailable;
+
+		mutable bool m_verified = false;
+
 	public:
 		LobbyFile(const std::string &filename);
 		~LobbyFile();
 
-		void Prepare(size_t size, uint64_t hash);
+		void Prepare(size_t size, uint64_t hash, const std::vector<uint64_t> &chunkHashes);
 
 		std::string GetCachePath() const;
 
 		void LoadFromCache();
+		// Picks up the verified chunks of an earlier, unfinished download of this file. Returns true if there was one.
+		bool LoadPartialFromCache();
 		void LoadFromFile(const std::string &filenameOnDisk);
 		void Load(uint8_t* buffer, size_t size);
 
-		void AppendData(uint8_t* buffer, size_t size);
-		void SaveToCache() const;
+		// Reads up to size bytes at the given offset, returns the amount of bytes read
+		size_t ReadData(size_t offset, uint8_t* buffer, size_t size) const;
+
+		size_t GetChunkCount() const;
+		size_t GetChunkSize(size_t index) const;
+		bool HasChunk(size_t index) const;
+		// Returns a bitmap of the chunks we have, where bit (i % 8) of byte (i / 8) is set for chunk i
+		std::vector<uint8_t> GetChunkBitmap() const;
+
+		// Checks the data against the hash of the chunk from the manifest
+		bool VerifyChunk(size_t index, const uint8_t* buffer, size_t size) const;
+		// Writes incoming chunk data to the partial cache file, which is created with the full size on the first
+		// call. Returns false if the data couldn't be written.
+		bool WriteChunk(size_t index, const uint8_t* buffer, size_t size);
+		void SaveToCache();
 
 		// Checks whether the data captured in this file is complete and valid. Note
-		// that this also computes and compares a hash for the entire buffer, so
-		// consider that while working in performance-critical code.
+		// that this also computes and compares a hash for the entire file the first
+		// time it is called, so consider that while working in performance-critical code.
 		bool IsValid() const;
 
 		double GetPercentage() const;
 		double GetPercentage(const struct OutgoingFileTransfer &transfer) const;
+
+	private:
+		void Close();
+		bool OpenPartial();
+		uint64_t ComputeHash(std::vector<uint64_t>* chunkHashes = nullptr) const;
 	};
 
 	struct OutgoingFileTransfer
 	{
 		uint64_t FileHash = 0;
 		int MemberPeer = 0;
+		// Amount of bytes the member has, including the chunks they already had when requesting the file
 		size_t CurrentPos = 0;
+
+		// Indices of the chunks the member asked for, which are sent in order
+		std::vector<uint32_t> Chunks;
+		size_t NextChunk = 0;
+	};
+
+	// A download of a file that is fetched from every member sharing a file with the same hash at once
+	struct IncomingFileTransfer
+	{
+		struct Source
+		{
+			int MemberPeer = 0;
+
+			// Chunks currently requested from this member, empty if it's waiting for a new batch
+			std::vector<uint32_t> Chunks;
+			size_t ChunksReceived = 0;
+			std::chrono::steady_clock::time_point BatchStart;
+			std::chrono::steady_clock::time_point LastActivity;
+
+			// Chunks per second this member delivered its last batch at, which determines the size of its next batch
+			double Rate = 0.0;
+
+			// Batches from this member that ended with chunks missing
+			int Failures = 0;
+		};
+
+		uint64_t FileHash = 0;
+		// The member whose file was requested, as the data is written to that file
+		int MemberPeer = 0;
+
+		std::vector<Source> Sources;
+		// Members that were dropped as a source after failing too often, so they're not added again
+		std::vector<int> FailedSources;
+		// Whether each chunk is currently requested from one of the sources
+		std::vector<bool> ChunksRequested;
 	};
 }
@@ -65,5 +65,15 @@ namespace Unet
 		// Sent by the client to announce a chat message they wrote
 		// Sent by the server to announce a chat message was sent by a client
 		LobbyChatMessage,
+
+		// Sent by anyone to deliver multiple internal messages coalesced into a single packet
+		Batch,
+
+		// Sent by the client to announce a batch of changes to their own member lobby data
+		// Sent by the server to announce a batch of changes to the lobby name, lobby data and member lobby data
+		LobbyDataBatch,
+
+		// Sent by the server to announce a new compression dictionary for channel payloads
+		LobbyCompressionDictionary,
 	};
 }
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <Unet_common.h>
+
+namespace Unet
+{
+	class NetworkMessage;
+
+	struct MessagePoolStats
+	{
+		// Amount of message headers and data blocks that had to be allocated from the system
+		size_t MessageAllocs = 0;
+		size_t BlockAllocs = 0;
+
+		// Amount of message headers and data blocks that were recycled from the pool
+		size_t MessageReuses = 0;
+		size_t BlockReuses = 0;
+
+		// Amount of messages that are currently handed out and not yet released
+		size_t MessagesInUse = 0;
+	};
+
+	// Pool of network messages and their payload buffers. Payload blocks are size-classed, every block is rounded
+	// up to a power of two, and freed blocks are kept around so that the next message of a similar size can reuse
+	// them. Message headers are recycled the same way, so that a steady stream of messages doesn't hit the heap.
+	class MessagePool
+	{
+	private:
+		static const int MinClassShift = 8; // 256 bytes
+		static const int NumClasses = 17; // Up to 16 MB, anything bigger is allocated directly
+
+		std::vector<uint8_t*> m_freeBlocks[NumClasses];
+		size_t m_cachedBytes = 0;
+
+		std::vector<void*> m_freeMessages;
+
+		MessagePoolStats m_stats;
+
+	public:
+		// The maximum amount of bytes that unused blocks may occupy before they're returned to the system.
+		size_t m_maxCachedBytes = 32 * 1024 * 1024;
+
+		// The maximum amount of unused message headers to keep around.
+		size_t m_maxCachedMessages = 1024;
+
+	public:
+		MessagePool();
+		~MessagePool();
+
+		// Allocates a message with room for the given amount of bytes. The message must be released with
+		// NetworkMessage::Release, which returns it to this pool.
+		NetworkMessage* AllocMessage(size_t size, size_t capacity = 0);
+		NetworkMessage* AllocMessage(const uint8_t* data, size_t size);
+		// Allocates a message that points to data owned by someone else, without copying it. The given function is
+		// called with the handle once the message is released.
+		NetworkMessage* AllocBorrowedMessage(uint8_t* data, size_t size, void (*release)(void*), void* handle);
+		void FreeMessage(NetworkMessage* msg);
+
+		// Allocates a block of at least the given size. The actual capacity of the block is written to outCapacity,
+		// and must be passed back to FreeBlock.
+		uint8_t* AllocBlock(size_t size, size_t* outCapacity);
+		void FreeBlock(uint8_t* block, size_t capacity);
+
+		const MessagePoolStats &GetStats() const;
+
+		void Clear();
+
+	private:
+		void* AllocHeader();
+		static int GetSizeClass(size_t size);
+	};
+}
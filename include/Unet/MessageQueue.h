@@ -0,0 +1,43 @@
+#pragma once
+
+#include <Unet_common.h>
+#include <Unet/NetworkMessage.h>
+
+namespace Unet
+{
+	enum class QueuePolicy
+	{
+		// Every message is kept until it's read
+		Fifo,
+		// At most a maximum amount of messages is kept, and the oldest ones are dropped to make room
+		DropOldest,
+		// Only the newest message from every peer is kept
+		LatestPerPeer,
+	};
+
+	// Received messages of a single channel, waiting to be read
+	class MessageQueue
+	{
+	private:
+		std::deque<NetworkMessage*> m_messages;
+
+		QueuePolicy m_policy = QueuePolicy::Fifo;
+		size_t m_maxMessages = 0;
+		size_t m_dropped = 0;
+
+	public:
+		void SetPolicy(QueuePolicy policy, size_t maxMessages);
+		QueuePolicy GetPolicy() const;
+
+		// Takes ownership of the message, and releases any messages that the policy drops because of it
+		void Push(NetworkMessage* msg);
+		// Returns nullptr if the queue is empty
+		NetworkMessage* Pop();
+
+		size_t Size() const;
+		// Amount of messages that were dropped because of the policy
+		size_t GetDropped() const;
+
+		void Clear();
+	};
+}
@@ -2,6 +2,7 @@
 
 #include <Unet_common.h>
 #include <Unet/ServiceID.h>
+#include <Unet/MessagePool.h>
 
 namespace Unet
 {
@@ -9,11 +10,23 @@ namespace Unet
 	{
 		Unreliable,
 		Reliable,
+		// Unreliable, and delivered without waiting for earlier packets on the channel
+		Unsequenced,
+		// Unreliable, and split into unreliable fragments if it doesn't fit in a single packet. If any fragment is
+		// lost, the whole message is lost.
+		UnreliableFragment,
+		// Unreliable, and if multiple messages are sent to the same peer and channel in one tick, only the last one
+		// is actually sent
+		LatestOnly,
 	};
 
 	class NetworkMessage
 	{
 	public:
+		// Called when a message that borrows its data from somewhere else (for example a service's own packet
+		// object) is released, so that the owner of the data can free it.
+		typedef void (*BorrowReleaseFunc)(void* handle);
+
 		uint8_t m_sequenceId = 0;
 		uint32_t m_sequenceSize = 0;
 		uint32_t m_sequenceHash = 0;
@@ -23,15 +36,44 @@ namespace Unet
 
 		uint8_t* m_data;
 		size_t m_size;
+		size_t m_capacity;
+
+		// The pool that this message and its data buffer were allocated from, or nullptr if it was allocated with new
+		MessagePool* m_pool = nullptr;
+		int m_refCount = 1;
+
+		// If the data is borrowed, this is the function that gives it back to its owner
+		BorrowReleaseFunc m_borrowRelease = nullptr;
+		void* m_borrowHandle = nullptr;
 
 	public:
 		NetworkMessage(size_t size);
 		NetworkMessage(uint8_t* data, size_t size);
+		NetworkMessage(MessagePool* pool, size_t size, size_t capacity);
+		NetworkMessage(MessagePool* pool, uint8_t* borrowedData, size_t size, BorrowReleaseFunc release, void* handle);
 		~NetworkMessage();
 
+		bool IsBorrowed() const;
+
+		// Appends data to the end of the message. This does not reallocate if the capacity is big enough.
 		void Append(uint8_t* data, size_t size);
+
+		void AddRef();
+		// Drops a reference to the message. When the last reference is dropped, the message is returned to its pool.
+		void Release();
+
+	private:
+		void FreeData();
+	};
+
+	struct NetworkMessageDeleter
+	{
+		void operator()(NetworkMessage* msg) const
+		{
+			msg->Release();
+		}
 	};
 
-	// A refcounted pointer to a NetworkMessage object.
-	typedef std::unique_ptr<NetworkMessage> NetworkMessageRef;
+	// A refcounted pointer to a NetworkMessage object. Pooled messages must be released before the context is destroyed.
+	typedef std::unique_ptr<NetworkMessage, NetworkMessageDeleter> NetworkMessageRef;
 }
@@ -9,13 +9,61 @@ namespace Unet
 	class Reassembly
 	{
 	private:
+		// Fragmented messages are identified by who sent them, on which channel, and with which sequence ID. Reliable
+		// sequence IDs are stored with the high bit set, so they never collide with unreliable ones.
+		struct StagingKey
+		{
+			ServiceID Peer;
+			int Channel;
+			uint8_t SequenceId;
+
+			bool operator==(const StagingKey &other) const
+			{
+				return Peer == other.Peer && Channel == other.Channel && SequenceId == other.SequenceId;
+			}
+		};
+
+		struct StagingKeyHash
+		{
+			size_t operator()(const StagingKey &key) const
+			{
+				return std::hash<ServiceID>()(key.Peer) ^ ((size_t)(key.Channel + 1) << 8) ^ key.SequenceId;
+			}
+		};
+
+		struct StagingEntry
+		{
+			// This is nullptr if the message was rejected, in which case we still have to swallow its remaining fragments
+			NetworkMessage* Message = nullptr;
+			size_t Remaining = 0;
+			size_t Reserved = 0;
+			// Hash and size of the full message, for unreliable messages. A lost fragment leaves an incomplete entry
+			// behind, which is replaced when a different message shows up with the same sequence ID.
+			uint32_t Hash = 0;
+			uint32_t Size = 0;
+			// Offsets of the unreliable fragments received so far, so duplicated fragments are ignored
+			std::unordered_set<uint32_t> ReceivedOffsets;
+			std::chrono::steady_clock::time_point LastActivity;
+		};
+
 		Internal::Context* m_ctx;
 
-		std::vector<NetworkMessage*> m_staging;
+		std::unordered_map<StagingKey, StagingEntry, StagingKeyHash> m_staging;
+		std::unordered_map<ServiceID, size_t> m_stagingBytes;
+		std::chrono::steady_clock::time_point m_nextTimeoutCheck;
+
 		std::queue<NetworkMessage*> m_ready;
 
 		std::vector<uint8_t> m_tempBuffer;
 		uint8_t m_sequenceId = 0;
+		uint8_t m_unreliableSequenceId = 0;
+
+	public:
+		// Partially received messages that haven't seen a new fragment for this long are discarded.
+		std::chrono::milliseconds m_stagingTimeout = std::chrono::seconds(10);
+
+		// The maximum amount of bytes that partially received messages from a single peer may occupy.
+		size_t m_maxStagingBytesPerPeer = 64 * 1024 * 1024;
 
 	public:
 		Reassembly(Internal::Context* ctx);
@@ -24,8 +72,23 @@ namespace Unet
 		void HandleMessage(ServiceID peer, int channel, uint8_t* msgData, size_t packetSize);
 		NetworkMessage* PopReady();
 
+		// Discards partially received messages that timed out. Called once per RunCallbacks.
+		void RunTimeouts();
+
 		void Clear();
+		void ClearPeer(const ServiceID &peer);
 
 		void SplitMessage(uint8_t* data, size_t size, PacketType type, size_t sizeLimit, const std::function<void(uint8_t*, size_t)> &callback);
+
+		// Splits a batch of coalesced channel messages back into the individual messages. Returns false if the batch
+		// is truncated, in which case the messages before the truncated one have already been passed on.
+		bool UnpackBatch(NetworkMessage* batch, const std::function<void(NetworkMessage*)> &callback);
+
+	private:
+		typedef std::unordered_map<StagingKey, StagingEntry, StagingKeyHash>::iterator StagingIterator;
+		StagingIterator RemoveStaging(StagingIterator it);
+
+		void HandleUnreliableFragment(ServiceID peer, int channel, uint8_t sequenceId, uint8_t* msgData, size_t packetSize);
+		void SplitUnreliableMessage(uint8_t* data, size_t size, size_t sizeLimit, const std::function<void(uint8_t*, size_t)> &callback);
 	};
 }
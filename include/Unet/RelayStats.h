@@ -0,0 +1,19 @@
+#pragma once
+
+#include <Unet_common.h>
+
+namespace Unet
+{
+	// Counters for packets that were relayed through the host, for a single route between two peers
+	struct RelayRouteStats
+	{
+		int FromPeer = -1;
+		int ToPeer = -1;
+
+		size_t Packets = 0;
+		size_t Bytes = 0;
+
+		// Amount of packets that couldn't be relayed, for example because the recipient is unknown
+		size_t Dropped = 0;
+	};
+}
@@ -7,6 +7,15 @@
 
 namespace Unet
 {
+	// Send state of the connection to a peer, as far as the service knows about it
+	struct ConnectionStatus
+	{
+		// Bytes of reliable data that are either queued or still waiting to be acknowledged
+		size_t PendingReliableBytes = 0;
+		// Mean round trip time in milliseconds, or 0 if the service doesn't know
+		uint32_t RoundTripTime = 0;
+	};
+
 	class Service
 	{
 	public:
@@ -17,7 +26,16 @@ namespace Unet
 		Service(Internal::Context* ctx, int numChannels);
 		virtual ~Service() {}
 
+		// Service channels are laid out as: internal lobby messages on 0, relayed packets on 1, the user channels
+		// starting at 2, and file data on the channel after the last user channel. Keeping file data on its own
+		// channel means it's sequenced independently, so it can't hold up lobby messages such as pings.
+		uint8_t GetFileChannel() const { return (uint8_t)(m_numChannels + 2); }
+
 		virtual void RunCallbacks() {}
+		// Hands packets that were queued since the last RunCallbacks to the network right away. Services that only
+		// transmit while running their callbacks should override this, otherwise packets sent after RunCallbacks
+		// wait until the next call.
+		virtual void Flush() {}
 
 		virtual void SimulateOutage() = 0;
 
@@ -52,8 +70,24 @@ namespace Unet
 
 		virtual size_t ReliablePacketLimit() = 0;
 
+		// Gets the send state of the connection to the given peer. Returns false if the service can't tell, which is
+		// also the default.
+		virtual bool GetConnectionStatus(const ServiceID &peerId, ConnectionStatus &status) { return false; }
+
 		virtual void SendPacket(const ServiceID &peerId, const void* data, size_t size, PacketType type, uint8_t channel) = 0;
+		// Sends the same packet to multiple peers. Services that can share a single packet between peers should
+		// override this, by default it just calls SendPacket for every peer.
+		virtual void SendPacketToMany(const std::vector<ServiceID> &peerIds, const void* data, size_t size, PacketType type, uint8_t channel);
 		virtual size_t ReadPacket(void* data, size_t maxSize, ServiceID* peerId, uint8_t channel) = 0;
 		virtual bool IsPacketAvailable(size_t* outPacketSize, uint8_t channel) = 0;
+
+		// Reads the next available packet on the given channel into a message, or returns nullptr if there is none.
+		// Services that keep received packets in their own buffers can override this to hand those buffers out
+		// directly instead of copying them.
+		virtual NetworkMessage* ReadMessage(MessagePool* pool, uint8_t channel);
+		// Sends a message that was previously read with ReadMessage (and possibly modified) on to another peer.
+		// Services that handed out their own packet buffers in ReadMessage can override this to send the packet
+		// itself instead of copying the data again. By default this just calls SendPacket.
+		virtual void ForwardMessage(const ServiceID &peerId, NetworkMessage* msg, PacketType type, uint8_t channel);
 	};
 }
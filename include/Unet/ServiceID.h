@@ -50,3 +50,15 @@ namespace Unet
 		}
 	};
 }
+
+namespace std
+{
+	template<>
+	struct hash<Unet::ServiceID>
+	{
+		size_t operator()(const Unet::ServiceID &id) const
+		{
+			return hash<uint64_t>()(id.ID) ^ ((size_t)id.Service << 48);
+		}
+	};
+}
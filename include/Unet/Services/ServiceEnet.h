@@ -30,7 +30,8 @@ namespace Unet
 	        static uint64_t m_applicationName;
 
 		ENetPeer* m_peerHost = nullptr;
-		std::vector<ENetPeer*> m_peers;
+		// Connected peers, keyed by their address ID
+		std::unordered_map<uint64_t, ENetPeer*> m_peers;
 
 		std::vector<std::queue<EnetPacket>> m_channels;
 
@@ -56,6 +57,7 @@ namespace Unet
 		virtual void SimulateOutage() override;
 
 		virtual void RunCallbacks() override;
+		virtual void Flush() override;
 
 		virtual ServiceType GetType() override;
 
@@ -87,10 +89,14 @@ namespace Unet
 		virtual void RemoveLobbyData(const ServiceID &lobbyId, const char* name) override;
 
 		virtual size_t ReliablePacketLimit() override;
+		virtual bool GetConnectionStatus(const ServiceID &peerId, ConnectionStatus &status) override;
 
 		virtual void SendPacket(const ServiceID &peerId, const void* data, size_t size, PacketType type, uint8_t channel) override;
+		virtual void SendPacketToMany(const std::vector<ServiceID> &peerIds, const void* data, size_t size, PacketType type, uint8_t channel) override;
 		virtual size_t ReadPacket(void* data, size_t maxSize, ServiceID* peerId, uint8_t channel) override;
 		virtual bool IsPacketAvailable(size_t* outPacketSize, uint8_t channel) override;
+		virtual NetworkMessage* ReadMessage(MessagePool* pool, uint8_t channel) override;
+		virtual void ForwardMessage(const ServiceID &peerId, NetworkMessage* msg, PacketType type, uint8_t channel) override;
 
 	        void StartSearch();
 	        void StopSearch();
@@ -101,6 +107,10 @@ namespace Unet
 
 	private:
 		ENetPeer* GetPeer(const ServiceID &id);
+		void AddPeer(ENetPeer* peer);
+		bool RemovePeer(ENetPeer* peer);
+		ServiceID GetPacketPeerID(const EnetPacket &packet);
+		static enet_uint32 GetPacketFlags(PacketType type);
 		void Clear(size_t numChannels);
 	};
 }
@@ -67,6 +67,7 @@ namespace Unet
 		virtual void RemoveLobbyData(const ServiceID &lobbyId, const char* name) override;
 
 		virtual size_t ReliablePacketLimit() override;
+		virtual bool GetConnectionStatus(const ServiceID &peerId, ConnectionStatus &status) override;
 
 		virtual void SendPacket(const ServiceID &peerId, const void* data, size_t size, PacketType type, uint8_t channel) override;
 		virtual size_t ReadPacket(void* data, size_t maxSize, ServiceID* peerId, uint8_t channel) override;
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <queue>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
 #include <Unet/guid.hpp>
 #include <Unet/json.hpp>
 using json = nlohmann::json;
@@ -22,7 +22,8 @@ Unet::Internal::Context::Context(int numChannels)
 	: m_reassembly(this)
 {
 	m_numChannels = numChannels;
-	m_queuedMessages.assign(numChannels, std::queue<NetworkMessage*>());
+	m_queuedMessages.resize(numChannels);
+	m_coalescedChannels.assign(numChannels, false);
 
 	m_status = ContextStatus::Idle;
 	m_primaryService = ServiceType::None;
@@ -49,10 +50,7 @@ Unet::Internal::Context::~Context()
 	}
 
 	for (auto &channel : m_queuedMessages) {
-		while (channel.size() > 0) {
-			delete channel.front();
-			channel.pop();
-		}
+		channel.Clear();
 	}
 }
 
@@ -107,6 +105,7 @@ void Unet::Internal::Context::RunCallbacks()
 	}
 
 	if (m_currentLobby != nullptr) {
+		m_currentLobby->HandleIncomingFileTransfers();
 		m_currentLobby->HandleOutgoingFileTransfers();
 	}
 
@@ -160,6 +159,17 @@ void Unet::Internal::Context::RunCallbacks()
 					m_reassembly.HandleMessage(peer, -1, msgData, packetSize);
 				}
 
+				// Re-assembly for file data channel
+				while (service->IsPacketAvailable(&packetSize, service->GetFileChannel())) {
+					PrepareReceiveBuffer(packetSize);
+
+					ServiceID peer;
+					service->ReadPacket(m_receiveBuffer.data(), packetSize, &peer, service->GetFileChannel());
+					uint8_t* msgData = m_receiveBuffer.data();
+
+					m_reassembly.HandleMessage(peer, FileReassemblyChannel, msgData, packetSize);
+				}
+
 				// Re-assembly for general purpose channels
 				for (int channel = 0; channel < m_numChannels; channel++) {
 					while (service->IsPacketAvailable(&packetSize, 2 + channel)) {
@@ -175,105 +185,50 @@ void Unet::Internal::Context::RunCallbacks()
 			}
 
 			// Relay packet channel
-			while (service->IsPacketAvailable(&packetSize, 1)) {
-				PrepareReceiveBuffer(packetSize);
-
-				ServiceID peer;
-				service->ReadPacket(m_receiveBuffer.data(), packetSize, &peer, 1);
-				uint8_t* msgData = m_receiveBuffer.data();
-
-				auto peerMember = m_currentLobby->GetMember(peer);
-
-				if (m_currentLobby->m_info.IsHosting) {
-					// We have to relay a packet to some client
-					uint8_t peerRecipient = *(msgData++);
-					uint8_t channel = *(msgData++);
-					PacketType type = (PacketType)*(msgData++);
-					packetSize -= 3;
-
-					auto recipientMember = m_currentLobby->GetMember((int)peerRecipient);
-					if (recipientMember == nullptr) {
-						if (m_callbacks != nullptr) {
-							m_callbacks->OnLogError(strPrintF("Tried relaying packet of %d bytes to unknown peer %d!", (int)packetSize, (int)peerRecipient));
-						}
-						continue;
-					}
-
-					PrepareSendBuffer(packetSize + 2);
-					uint8_t* relayMsg = m_sendBuffer.data();
-					relayMsg[0] = (uint8_t)peerMember->UnetPeer;
-					relayMsg[1] = channel;
-					memcpy(relayMsg + 2, msgData, packetSize);
-
-					auto id = recipientMember->GetDataServiceID();
-					assert(id.IsValid());
-					if (!id.IsValid()) {
-						continue;
-					}
-
-					auto recipientService = GetService(id.Service);
-					assert(recipientService != nullptr);
-					if (recipientService == nullptr) {
-						continue;
-					}
-
-					recipientService->SendPacket(id, relayMsg, packetSize + 2, type, 1);
-
-				} else {
-					// We received a relayed packet from some client
-					uint8_t peerSender = *(msgData++);
-					uint8_t channel = *(msgData++);
-					packetSize -= 2;
-
-					if (channel >= (uint8_t)m_queuedMessages.size()) {
-						if (m_callbacks != nullptr) {
-							m_callbacks->OnLogError(strPrintF("Invalid channel index in relay packet: %d", (int)channel));
-						}
-						continue;
-					}
-
-					auto memberSender = m_currentLobby->GetMember(peerSender);
-					assert(memberSender != nullptr);
-					if (memberSender == nullptr) {
-						if (m_callbacks != nullptr) {
-							m_callbacks->OnLogError(strPrintF("Received a relay packet from unknown peer %d", (int)peerSender));
-						}
-						continue;
-					}
-
-					if (packetSizeLimit > 0) {
-						m_reassembly.HandleMessage(memberSender->GetPrimaryServiceID(), (int)channel, msgData, packetSize);
-					} else {
-						auto newMessage = new NetworkMessage(msgData, packetSize);
-						newMessage->m_channel = (int)channel;
-						newMessage->m_peer = memberSender->GetPrimaryServiceID();
-						m_queuedMessages[channel].push(newMessage);
-					}
-				}
+			while (auto msg = service->ReadMessage(&m_messagePool, 1)) {
+				HandleRelayMessage(service, msg);
+				msg->Release();
 			}
 
 			if (packetSizeLimit == 0) {
-				while (service->IsPacketAvailable(&packetSize, 0)) {
-					PrepareReceiveBuffer(packetSize);
-
-					ServiceID peer;
-					service->ReadPacket(m_receiveBuffer.data(), packetSize, &peer, 0);
+				while (auto msg = service->ReadMessage(&m_messagePool, 0)) {
+					m_currentLobby->HandleMessage(msg->m_peer, msg->m_data, msg->m_size);
+					msg->Release();
+				}
 
-					m_currentLobby->HandleMessage(peer, m_receiveBuffer.data(), packetSize);
+				while (auto msg = service->ReadMessage(&m_messagePool, service->GetFileChannel())) {
+					m_currentLobby->HandleMessage(msg->m_peer, msg->m_data, msg->m_size);
+					msg->Release();
 				}
 			}
 		}
 	}
 
+	m_reassembly.RunTimeouts();
+
 	// Pop any fragmented messages into the message queue
 	while (auto msg = m_reassembly.PopReady()) {
-		if (msg->m_channel == -1) {
+		if (msg->m_channel == -1 || msg->m_channel == FileReassemblyChannel) {
 			m_currentLobby->HandleMessage(msg->m_peer, msg->m_data, msg->m_size);
-			delete msg;
+			msg->Release();
 		} else {
-			m_queuedMessages[msg->m_channel].push(msg);
+			QueueMessage(msg);
 		}
 	}
+
+	if (m_currentLobby != nullptr) {
+		m_currentLobby->FlushDataChanges();
+	}
+
+	FlushInternalMessages();
+	FlushLatestOnlyMessages();
+	FlushChannelMessages();
+
+	// The services already ran at the top, so latest-only messages and coalesced batches would otherwise only go
+	// out next frame
+	for (auto service : m_services) {
+		service->Flush();
+	}
 }
 
 void Unet::Internal::Context::SetPrimaryService(ServiceType service)
@@ -294,6 +249,29 @@ void Unet::Internal::Context::SetPrimaryService(ServiceType service)
 	}
 }
 
+void Unet::Internal::Context::SetInternalMessageCoalescing(bool enabled)
+{
+	if (!enabled) {
+		FlushInternalMessages();
+	}
+	m_coalesceInternalMessages = enabled;
+}
+
+void Unet::Internal::Context::SetChannelCoalescing(int channel, bool enabled)
+{
+	if (channel < 0 || channel >= (int)m_coalescedChannels.size()) {
+		if (m_callbacks != nullptr) {
+			m_callbacks->OnLogError(strPrintF("Can't set coalescing of invalid channel %d", channel));
+		}
+		return;
+	}
+
+	if (!enabled) {
+		FlushChannelMessages();
+	}
+	m_coalescedChannels[channel] = enabled;
+}
+
 Unet::ServiceType Unet::Internal::Context::GetPrimaryService()
 {
 	return m_primaryService;
@@ -362,10 +340,7 @@ void Unet::Internal::Context::CreateLobby(LobbyPrivacy privacy, int maxPlayers,
 	m_localPeer = 0;
 
 	for (auto &channel : m_queuedMessages) {
-		while (channel.size() > 0) {
-			delete channel.front();
-			channel.pop();
-		}
+		channel.Clear();
 	}
 
 	auto &result = m_callbackCreateLobby.GetResult();
@@ -428,10 +403,7 @@ void Unet::Internal::Context::JoinLobby(const LobbyInfo &lobbyInfo)
 	m_localPeer = -1;
 
 	for (auto &channel : m_queuedMessages) {
-		while (channel.size() > 0) {
-			delete channel.front();
-			channel.pop();
-		}
+		channel.Clear();
 	}
 
 	auto &result = m_callbackLobbyJoin.GetResult();
@@ -633,6 +605,15 @@ void Unet::Internal::Context::RequestFile(LobbyMember* member, const char* filen
 
 void Unet::Internal::Context::RequestFile(LobbyMember* member, LobbyFile* file)
 {
+	if (file->LoadPartialFromCache() && file->IsValid()) {
+		// An earlier download was interrupted right before it finished
+		if (m_callbacks != nullptr) {
+			m_callbacks->OnLobbyFileDataReceiveFinished(member, file, true);
+		}
+		file->SaveToCache();
+		return;
+	}
+
 	if (file->IsValid()) {
 		if (m_callbacks != nullptr) {
 			m_callbacks->OnLogError(strPrintF("Attempted requesting file \"%s\" from member, but the file is already valid!", file->m_filename.c_str()));
@@ -640,10 +621,16 @@ void Unet::Internal::Context::RequestFile(LobbyMember* member, LobbyFile* file)
 		return;
 	}
 
-	json js;
-	js["t"] = (uint8_t)LobbyPacketType::LobbyFileRequested;
-	js["filename"] = file->m_filename;
-	InternalSendTo(member, js);
+	if (m_currentLobby == nullptr) {
+		return;
+	}
+
+	m_currentLobby->StartIncomingFileTransfer(member, file);
+}
+
+void Unet::Internal::Context::SetFileBandwidthLimit(size_t bytesPerSecond)
+{
+	m_fileBandwidthLimit = bytesPerSecond;
 }
 
 void Unet::Internal::Context::SendChat(const char* message)
@@ -680,62 +667,96 @@ bool Unet::Internal::Context::IsMessageAvailable(int channel)
 		return false;
 	}
 
-	if (channel < (int)m_queuedMessages.size()) {
-		auto &queuedChannel = m_queuedMessages[channel];
-		if (queuedChannel.size() > 0) {
-			return true;
+	if (channel >= (int)m_queuedMessages.size()) {
+		return false;
+	}
+
+	// Every packet has to be looked at to strip its frame byte and to unpack batches
+	QueueServiceMessages(channel);
+	return m_queuedMessages[channel].Size() > 0;
+}
+
+void Unet::Internal::Context::SetChannelQueuePolicy(int channel, QueuePolicy policy, size_t maxMessages)
+{
+	if (channel < 0 || channel >= (int)m_queuedMessages.size()) {
+		if (m_callbacks != nullptr) {
+			m_callbacks->OnLogError(strPrintF("Can't set the queue policy of invalid channel %d", channel));
 		}
+		return;
+	}
+
+	m_queuedMessages[channel].SetPolicy(policy, maxMessages);
+}
+
+size_t Unet::Internal::Context::GetDroppedMessages(int channel)
+{
+	if (channel < 0 || channel >= (int)m_queuedMessages.size()) {
+		return 0;
 	}
+	return m_queuedMessages[channel].GetDropped();
+}
 
+void Unet::Internal::Context::QueueServiceMessages(int channel)
+{
 	for (auto service : m_services) {
-		// For services that have a reliable packet limit, we only allow queued messages
+		// Services with a reliable packet limit already go through the queue after reassembly
 		if (service->ReliablePacketLimit() > 0) {
 			continue;
 		}
 
-		if (service->IsPacketAvailable(nullptr, 2 + channel)) {
-			return true;
+		while (auto msg = service->ReadMessage(&m_messagePool, 2 + channel)) {
+			msg->m_channel = channel;
+			QueueMessage(msg);
 		}
 	}
+}
 
-	return false;
+const Unet::MessagePoolStats &Unet::Internal::Context::GetMessagePoolStats()
+{
+	return m_messagePool.GetStats();
 }
 
-Unet::NetworkMessageRef Unet::Internal::Context::ReadMessage(int channel)
+void Unet::Internal::Context::SetCompressionDictionary(const uint8_t* data, size_t size)
 {
-	if (channel < 0) {
-		return nullptr;
-	}
+	m_dictionaryCodec.SetDictionary(data, size);
 
-	if (channel < (int)m_queuedMessages.size()) {
-		auto &queuedChannel = m_queuedMessages[channel];
-		if (queuedChannel.size() > 0) {
-			NetworkMessageRef ret(queuedChannel.front());
-			queuedChannel.pop();
-			return ret;
-		}
+	if (m_currentLobby != nullptr && m_currentLobby->m_info.IsHosting) {
+		auto &dictionary = m_dictionaryCodec.GetDictionary();
+
+		json js;
+		js["t"] = (uint8_t)LobbyPacketType::LobbyCompressionDictionary;
+		InternalSendToAll(js, (uint8_t*)dictionary.data(), dictionary.size());
 	}
+}
 
-	for (auto service : m_services) {
-		// For services that have a reliable packet limit, we only allow queued messages
-		//TODO: Optimization: Unreliable packets can still be read from here without issue! The first byte
-		//      will have the 0x80 bit set to 0 if the packet is unreliable. If we read this byte, we can
-		//      just return the message from there.
-		if (service->ReliablePacketLimit() > 0) {
-			continue;
-		}
+Unet::DictionaryCodec &Unet::Internal::Context::GetDictionaryCodec()
+{
+	return m_dictionaryCodec;
+}
 
-		size_t packetSize;
-		if (service->IsPacketAvailable(&packetSize, 2 + channel)) {
-			//TODO: Optimization: Don't allocate memory for every message! We could send a local value instead
-			//      and leave the message allocation to RunCallbacks() for packets that need re-assembly.
-			NetworkMessageRef newMessage(new NetworkMessage(packetSize));
-			newMessage->m_channel = channel;
-			newMessage->m_size = service->ReadPacket(newMessage->m_data, packetSize, &newMessage->m_peer, 2 + channel);
-			return newMessage;
-		}
+std::vector<Unet::RelayRouteStats> Unet::Internal::Context::GetRelayStats()
+{
+	std::vector<RelayRouteStats> ret;
+	for (auto &pair : m_relayStats) {
+		ret.emplace_back(pair.second);
+	}
+	return ret;
+}
+
+Unet::NetworkMessageRef Unet::Internal::Context::ReadMessage(int channel)
+{
+	if (channel < 0 || channel >= (int)m_queuedMessages.size()) {
+		return nullptr;
 	}
 
+	// Every packet has to be looked at to strip its frame byte and to unpack batches. This also lets the queue
+	// policy drop stale messages, as everything that arrived so far is in the queue.
+	QueueServiceMessages(channel);
+
+	auto &queuedChannel = m_queuedMessages[channel];
+	if (queuedChannel.Size() > 0) {
+		return NetworkMessageRef(queuedChannel.Pop());
+	}
 	return nullptr;
 }
 
@@ -769,6 +790,10 @@ void Unet::Internal::Context::SendTo_Impl(LobbyMember* member, uint8_t* data, si
 		memcpy(msg + 3, data, size);
 
 		serviceHost->SendPacket(idHost, msg, size + 3, type, 1);
+
+		auto &route = GetRelayRoute(m_localPeer, member->UnetPeer);
+		route.Packets++;
+		route.Bytes += size;
 		return;
 	}
 
@@ -776,6 +801,34 @@ void Unet::Internal::Context::SendTo_Impl(LobbyMember* member, uint8_t* data, si
 }
 
 void Unet::Internal::Context::SendTo(LobbyMember* member, uint8_t* data, size_t size, PacketType type, uint8_t channel)
+{
+	if (type == PacketType::LatestOnly) {
+		// Replaces anything sent to this peer and channel earlier in the tick, and is sent in RunCallbacks
+		auto &pending = m_latestOnlyMessages[((uint32_t)member->UnetPeer << 8) | channel];
+		pending.assign(data, data + size);
+		return;
+	}
+
+	if (channel < m_coalescedChannels.size() && m_coalescedChannels[channel]) {
+		QueueChannelMessage(member, data, size, type, channel);
+		return;
+	}
+
+	size = PrepareChannelFrame(data, size, ChannelFrame::Message);
+	SendTo_Split(member, m_frameBuffer.data(), size, type, channel);
+}
+
+size_t Unet::Internal::Context::PrepareChannelFrame(uint8_t* data, size_t size, ChannelFrame frame)
+{
+	if (m_frameBuffer.size() < size + 1) {
+		m_frameBuffer.resize((size_t)((size + 1) * 1.5));
+	}
+	memcpy(m_frameBuffer.data(), data, size);
+	m_frameBuffer[size] = (uint8_t)frame;
+	return size + 1;
+}
+
+void Unet::Internal::Context::SendTo_Split(LobbyMember* member, uint8_t* data, size_t size, PacketType type, uint8_t channel)
 {
 	auto id = member->GetDataServiceID();
 
@@ -802,16 +855,9 @@ void Unet::Internal::Context::SendTo(LobbyMember* member, uint8_t* data, size_t
 			return;
 		}
 
-		/*
-		m_reassembly.SplitMessage(data, size, type, sizeLimit, [this, member, channel](uint8_t * data, size_t size) {
-			SendTo_Impl(member, data, size, PacketType::Unreliable, channel);
+		m_reassembly.SplitMessage(data, size, type, sizeLimit, [this, member, type, channel](uint8_t * data, size_t size) {
+			SendTo_Impl(member, data, size, type, channel);
 		});
-		*/
-		
-		PrepareSendBuffer(size + 1);
-		m_sendBuffer[0] = 0;
-		memcpy(m_sendBuffer.data() + 1, data, size);
-		SendTo_Impl(member, m_sendBuffer.data(), size + 1, type, channel);
 	}
 }
 
@@ -822,6 +868,7 @@ void Unet::Internal::Context::SendToAll(uint8_t* data, size_t size, PacketType t
 		return;
 	}
 
+	std::vector<LobbyMember*> members;
 	for (auto member : m_currentLobby->m_members) {
 		if (!member->Valid) {
 			continue;
@@ -831,8 +878,10 @@ void Unet::Internal::Context::SendToAll(uint8_t* data, size_t size, PacketType t
 			continue;
 		}
 
-		SendTo(member, data, size, type, channel);
+		members.emplace_back(member);
 	}
+
+	SendToMany(members, data, size, type, channel);
 }
 
 void Unet::Internal::Context::SendToAllExcept(LobbyMember* exceptMember, uint8_t* data, size_t size, PacketType type, uint8_t channel)
@@ -842,6 +891,7 @@ void Unet::Internal::Context::SendToAllExcept(LobbyMember* exceptMember, uint8_t
 		return;
 	}
 
+	std::vector<LobbyMember*> members;
 	for (auto member : m_currentLobby->m_members) {
 		if (!member->Valid) {
 			continue;
@@ -855,8 +905,163 @@ void Unet::Internal::Context::SendToAllExcept(LobbyMember* exceptMember, uint8_t
 			continue;
 		}
 
-		SendTo(member, data, size, type, channel);
+		members.emplace_back(member);
+	}
+
+	SendToMany(members, data, size, type, channel);
+}
+
+void Unet::Internal::Context::SendToMany(const std::vector<LobbyMember*> &members, uint8_t* data, size_t size, PacketType type, uint8_t channel)
+{
+	bool coalesced = channel < m_coalescedChannels.size() && m_coalescedChannels[channel];
+	if (type == PacketType::LatestOnly || coalesced) {
+		for (auto member : members) {
+			SendTo(member, data, size, type, channel);
+		}
+		return;
+	}
+
+	size = PrepareChannelFrame(data, size, ChannelFrame::Message);
+	data = m_frameBuffer.data();
+
+	std::vector<ServiceID> ids;
+
+	for (auto service : m_services) {
+		// Gather all recipients that we can reach directly through this service
+		ids.clear();
+		for (auto member : members) {
+			auto id = member->GetDataServiceID();
+			if (id.IsValid() && id.Service == service->GetType()) {
+				ids.emplace_back(id);
+			}
+		}
+
+		if (ids.size() == 0) {
+			continue;
+		}
+
+		// Split the message only once, and send the same fragments to every recipient
+		size_t sizeLimit = service->ReliablePacketLimit();
+
+		if (sizeLimit == 0) {
+			service->SendPacketToMany(ids, data, size, type, channel + 2);
+
+		} else {
+			m_reassembly.SplitMessage(data, size, type, sizeLimit, [service, &ids, type, channel](uint8_t* data, size_t size) {
+				service->SendPacketToMany(ids, data, size, type, channel + 2);
+			});
+		}
+	}
+
+	// Members without a direct connection have their own relay header, so they have to be sent to separately
+	for (auto member : members) {
+		auto id = member->GetDataServiceID();
+		if (!id.IsValid() || GetService(id.Service) == nullptr) {
+			SendTo_Split(member, data, size, type, channel);
+		}
+	}
+}
+
+void Unet::Internal::Context::FlushLatestOnlyMessages()
+{
+	if (m_latestOnlyMessages.size() == 0) {
+		return;
+	}
+
+	if (m_currentLobby != nullptr) {
+		for (auto &pair : m_latestOnlyMessages) {
+			// The peer might have left since the message was sent
+			auto member = m_currentLobby->GetMember((int)(pair.first >> 8));
+			if (member == nullptr) {
+				continue;
+			}
+
+			// Sent as sequenced unreliable, so that services drop it if a newer one arrives first
+			SendTo(member, pair.second.data(), pair.second.size(), PacketType::Unreliable, (uint8_t)(pair.first & 0xFF));
+		}
+	}
+
+	m_latestOnlyMessages.clear();
+}
+
+void Unet::Internal::Context::QueueChannelMessage(LobbyMember* member, uint8_t* data, size_t size, PacketType type, uint8_t channel)
+{
+	uint32_t key = ((uint32_t)member->UnetPeer << 8) | channel;
+	auto &pending = m_pendingChannelMessages[key];
+
+	// A batch is sent as a single packet type, so a message of another type ends the batch to keep the order
+	if (pending.Count > 0 && (pending.Type != type || pending.Data.size() + 4 + size + 1 > CoalescedBatchSize)) {
+		FlushChannelMessages(key, pending);
+	}
+	pending.Type = type;
+
+	uint32_t msgSize = (uint32_t)size;
+	size_t offset = pending.Data.size();
+	pending.Data.resize(offset + 4 + size);
+	memcpy(pending.Data.data() + offset, &msgSize, 4);
+	memcpy(pending.Data.data() + offset + 4, data, size);
+	pending.Count++;
+}
+
+void Unet::Internal::Context::FlushChannelMessages(uint32_t key, PendingChannelMessages &pending)
+{
+	if (pending.Count == 0) {
+		return;
+	}
+
+	// The peer might have left since the messages were sent
+	auto member = (m_currentLobby != nullptr) ? m_currentLobby->GetMember((int)(key >> 8)) : nullptr;
+	if (member != nullptr) {
+		pending.Data.push_back((uint8_t)ChannelFrame::Batch);
+		SendTo_Split(member, pending.Data.data(), pending.Data.size(), pending.Type, (uint8_t)(key & 0xFF));
+	}
+
+	// Keep the buffer around, as the next tick will likely send to the same peer again
+	pending.Data.clear();
+	pending.Count = 0;
+}
+
+void Unet::Internal::Context::FlushChannelMessages()
+{
+	for (auto &pair : m_pendingChannelMessages) {
+		FlushChannelMessages(pair.first, pair.second);
+	}
+}
+
+void Unet::Internal::Context::QueueMessage(NetworkMessage* msg)
+{
+	if (msg->m_size == 0) {
+		if (m_callbacks != nullptr) {
+			m_callbacks->OnLogError(strPrintF("Received an empty packet from 0x%016llX on channel %d", msg->m_peer.ID, msg->m_channel));
+		}
+		msg->Release();
+		return;
+	}
+
+	// Strip the frame byte off the end, which leaves the data pointer alone for borrowed messages
+	msg->m_size--;
+	auto frame = (ChannelFrame)msg->m_data[msg->m_size];
+
+	auto &queue = m_queuedMessages[msg->m_channel];
+	if (frame == ChannelFrame::Message) {
+		queue.Push(msg);
+		return;
+	}
+
+	if (frame != ChannelFrame::Batch) {
+		if (m_callbacks != nullptr) {
+			m_callbacks->OnLogError(strPrintF("Unknown frame type %d in packet from 0x%016llX on channel %d", (int)frame, msg->m_peer.ID, msg->m_channel));
+		}
+		msg->Release();
+		return;
+	}
+
+	if (!m_reassembly.UnpackBatch(msg, [&queue](NetworkMessage* part) { queue.Push(part); })) {
+		if (m_callbacks != nullptr) {
+			m_callbacks->OnLogError(strPrintF("Coalesced batch of %d bytes from 0x%016llX on channel %d is truncated", (int)msg->m_size, msg->m_peer.ID, msg->m_channel));
+		}
 	}
+	msg->Release();
 }
 
 void Unet::Internal::Context::SendToHost(uint8_t* data, size_t size, PacketType type, uint8_t channel)
@@ -917,27 +1122,41 @@ void Unet::Internal::Context::InternalSendTo(const ServiceID &id, const json &js
 		return;
 	}
 
-	auto msg = JsonPack(js);
+	bool coalesce = (m_coalesceInternalMessages && binarySize == 0);
+	if (!coalesce) {
+		// Anything still queued for this peer has to go out first to keep messages in order
+		FlushInternalMessages(id);
+	}
 
-	size_t finalMsgSize = msg.size() + binarySize + 4;
-	PrepareSendBuffer(finalMsgSize);
+	size_t msgSize = PackInternalMessage(js, binaryData, binarySize);
 
-	uint32_t msgSize = (uint32_t)msg.size();
-	memcpy(m_sendBuffer.data(), &msgSize, 4);
-	memcpy(m_sendBuffer.data() + 4, msg.data(), msg.size());
-	if (binaryData != nullptr && binarySize > 0) {
-		memcpy(m_sendBuffer.data() + 4 + msg.size(), binaryData, binarySize);
+	if (coalesce) {
+		QueueInternalMessage(id, m_sendBuffer.data(), msgSize);
+		return;
 	}
 
-	size_t sizeLimit = service->ReliablePacketLimit();
-	if (sizeLimit == 0) {
-		service->SendPacket(id, m_sendBuffer.data(), finalMsgSize, PacketType::Reliable, 0);
+	InternalSendPacked(service, { id }, m_sendBuffer.data(), msgSize);
+}
+
+void Unet::Internal::Context::InternalSendFileData(LobbyMember* member, const json &js, uint8_t* binaryData, size_t binarySize)
+{
+	assert(member->UnetPeer != m_localPeer);
+
+	auto id = member->GetDataServiceID();
+	assert(id.IsValid());
+	if (!id.IsValid()) {
 		return;
 	}
 
-	m_reassembly.SplitMessage(m_sendBuffer.data(), finalMsgSize, PacketType::Reliable, sizeLimit, [service, id](uint8_t* data, size_t size) {
-		service->SendPacket(id, data, size, PacketType::Reliable, 0);
-	});
+	auto service = GetService(id.Service);
+	assert(service != nullptr);
+	if (service == nullptr) {
+		return;
+	}
+
+	// The file channel is sequenced on its own, so there's no need to flush any coalesced lobby messages first
+	size_t msgSize = PackInternalMessage(js, binaryData, binarySize);
+	InternalSendPacked(service, { id }, m_sendBuffer.data(), msgSize, service->GetFileChannel());
 }
 
 void Unet::Internal::Context::InternalSendToAll(const json &js, uint8_t* binaryData, size_t binarySize)
@@ -947,11 +1166,14 @@ void Unet::Internal::Context::InternalSendToAll(const json &js, uint8_t* binaryD
 		return;
 	}
 
+	std::vector<LobbyMember*> members;
 	for (auto member : m_currentLobby->m_members) {
 		if (member->UnetPeer != m_localPeer) {
-			InternalSendTo(member, js, binaryData, binarySize);
+			members.emplace_back(member);
 		}
 	}
+
+	InternalSendToMany(members, js, binaryData, binarySize);
 }
 
 void Unet::Internal::Context::InternalSendToAllExcept(LobbyMember* exceptMember, const json &js, uint8_t* binaryData, size_t binarySize)
@@ -961,13 +1183,141 @@ void Unet::Internal::Context::InternalSendToAllExcept(LobbyMember* exceptMember,
 		return;
 	}
 
+	std::vector<LobbyMember*> members;
 	for (auto member : m_currentLobby->m_members) {
 		if (member->UnetPeer != m_localPeer && member->UnetPeer != exceptMember->UnetPeer) {
-			InternalSendTo(member, js, binaryData, binarySize);
+			members.emplace_back(member);
+		}
+	}
+
+	InternalSendToMany(members, js, binaryData, binarySize);
+}
+
+void Unet::Internal::Context::InternalSendToMany(const std::vector<LobbyMember*> &members, const json &js, uint8_t* binaryData, size_t binarySize)
+{
+	bool coalesce = (m_coalesceInternalMessages && binarySize == 0);
+	if (!coalesce) {
+		for (auto member : members) {
+			FlushInternalMessages(member->GetDataServiceID());
+		}
+	}
+
+	// Serialize the message only once for all recipients
+	size_t msgSize = PackInternalMessage(js, binaryData, binarySize);
+
+	if (coalesce) {
+		for (auto member : members) {
+			auto id = member->GetDataServiceID();
+			if (id.IsValid()) {
+				QueueInternalMessage(id, m_sendBuffer.data(), msgSize);
+			}
+		}
+		return;
+	}
+
+	std::vector<ServiceID> ids;
+	for (auto service : m_services) {
+		ids.clear();
+		for (auto member : members) {
+			auto id = member->GetDataServiceID();
+			if (id.IsValid() && id.Service == service->GetType()) {
+				ids.emplace_back(id);
+			}
+		}
+
+		if (ids.size() > 0) {
+			InternalSendPacked(service, ids, m_sendBuffer.data(), msgSize);
 		}
 	}
 }
 
+size_t Unet::Internal::Context::PackInternalMessage(const json &js, uint8_t* binaryData, size_t binarySize)
+{
+	auto msg = JsonPack(js);
+
+	size_t finalMsgSize = msg.size() + binarySize + 4;
+	PrepareSendBuffer(finalMsgSize);
+
+	uint32_t msgSize = (uint32_t)msg.size();
+	memcpy(m_sendBuffer.data(), &msgSize, 4);
+	memcpy(m_sendBuffer.data() + 4, msg.data(), msg.size());
+	if (binaryData != nullptr && binarySize > 0) {
+		memcpy(m_sendBuffer.data() + 4 + msg.size(), binaryData, binarySize);
+	}
+
+	return finalMsgSize;
+}
+
+void Unet::Internal::Context::InternalSendPacked(Service* service, const std::vector<ServiceID> &ids, uint8_t* data, size_t size, uint8_t channel)
+{
+	size_t sizeLimit = service->ReliablePacketLimit();
+	if (sizeLimit == 0) {
+		service->SendPacketToMany(ids, data, size, PacketType::Reliable, channel);
+		return;
+	}
+
+	m_reassembly.SplitMessage(data, size, PacketType::Reliable, sizeLimit, [service, &ids, channel](uint8_t* data, size_t size) {
+		service->SendPacketToMany(ids, data, size, PacketType::Reliable, channel);
+	});
+}
+
+void Unet::Internal::Context::QueueInternalMessage(const ServiceID &id, uint8_t* data, size_t size)
+{
+	auto &pending = m_pendingInternalMessages[id];
+
+	uint32_t msgSize = (uint32_t)size;
+	size_t offset = pending.Data.size();
+	pending.Data.resize(offset + 4 + size);
+	memcpy(pending.Data.data() + offset, &msgSize, 4);
+	memcpy(pending.Data.data() + offset + 4, data, size);
+	pending.Count++;
+}
+
+void Unet::Internal::Context::FlushInternalMessages(const ServiceID &id)
+{
+	auto it = m_pendingInternalMessages.find(id);
+	if (it == m_pendingInternalMessages.end()) {
+		return;
+	}
+
+	FlushInternalMessages(it);
+	m_pendingInternalMessages.erase(it);
+}
+
+void Unet::Internal::Context::FlushInternalMessages()
+{
+	for (auto it = m_pendingInternalMessages.begin(); it != m_pendingInternalMessages.end(); it++) {
+		FlushInternalMessages(it);
+	}
+	m_pendingInternalMessages.clear();
+}
+
+void Unet::Internal::Context::FlushInternalMessages(PendingInternalIterator it)
+{
+	auto &id = it->first;
+	auto &pending = it->second;
+
+	if (pending.Count == 0) {
+		return;
+	}
+
+	auto service = GetService(id.Service);
+	if (service == nullptr) {
+		return;
+	}
+
+	if (pending.Count == 1) {
+		// No need to wrap a single message in a batch
+		InternalSendPacked(service, { id }, pending.Data.data() + 4, pending.Data.size() - 4);
+		return;
+	}
+
+	json js;
+	js["t"] = (uint8_t)LobbyPacketType::Batch;
+	size_t msgSize = PackInternalMessage(js, pending.Data.data(), pending.Data.size());
+	InternalSendPacked(service, { id }, m_sendBuffer.data(), msgSize);
+}
+
 void Unet::Internal::Context::InternalSendToHost(const json &js, uint8_t* binaryData, size_t binarySize)
 {
 	assert(m_currentLobby != nullptr);
@@ -1016,8 +1366,7 @@ void Unet::Internal::Context::OnLobbyCreated(const CreateLobbyResult &result)
 		for (auto service : m_services) {
 			newMember->IDs.emplace_back(service->GetUserID());
 		}
-		m_currentLobby->m_members.emplace_back(newMember);
-		m_currentLobby->m_info.NumPlayers++;
+		m_currentLobby->InsertMember(newMember);
 
 		m_currentLobby->SetRichPresence();
 	}
@@ -1097,11 +1446,13 @@ void Unet::Internal::Context::OnLobbyLeft(const LobbyLeftResult &result)
 	m_status = ContextStatus::Idle;
 	m_localPeer = -1;
 
+	m_pendingInternalMessages.clear();
+	m_relayStats.clear();
+	m_latestOnlyMessages.clear();
+	m_pendingChannelMessages.clear();
+
 	for (auto &channel : m_queuedMessages) {
-		while (channel.size() > 0) {
-			delete channel.front();
-			channel.pop();
-		}
+		channel.Clear();
 	}
 
 	if (m_callbacks != nullptr) {
@@ -1132,6 +1483,103 @@ void Unet::Internal::Context::OnLobbyPlayerLeft(LobbyMember* member)
 	}
 }
 
+void Unet::Internal::Context::HandleRelayMessage(Service* service, NetworkMessage* msg)
+{
+	// Relay packets start with a 3 byte header: the peer (recipient when sent to the host, sender when sent by
+	// the host), the channel, and the packet type
+	if (msg->m_size < 3) {
+		if (m_callbacks != nullptr) {
+			m_callbacks->OnLogError(strPrintF("Received a relay packet that is too small (%d bytes)", (int)msg->m_size));
+		}
+		return;
+	}
+
+	uint8_t peer = msg->m_data[0];
+	uint8_t channel = msg->m_data[1];
+	PacketType type = (PacketType)msg->m_data[2];
+
+	uint8_t* msgData = msg->m_data + 3;
+	size_t packetSize = msg->m_size - 3;
+
+	if (m_currentLobby->m_info.IsHosting) {
+		// We have to relay a packet to some client
+		auto peerMember = m_currentLobby->GetMember(msg->m_peer);
+		if (peerMember == nullptr) {
+			if (m_callbacks != nullptr) {
+				m_callbacks->OnLogError(strPrintF("Received a relay packet of %d bytes from unknown %s ID 0x%016llX!", (int)packetSize, GetServiceNameByType(msg->m_peer.Service), msg->m_peer.ID));
+			}
+			return;
+		}
+
+		auto &route = GetRelayRoute(peerMember->UnetPeer, (int)peer);
+
+		auto recipientMember = m_currentLobby->GetMember((int)peer);
+		if (recipientMember == nullptr) {
+			if (m_callbacks != nullptr) {
+				m_callbacks->OnLogError(strPrintF("Tried relaying packet of %d bytes to unknown peer %d!", (int)packetSize, (int)peer));
+			}
+			route.Dropped++;
+			return;
+		}
+
+		auto id = recipientMember->GetDataServiceID();
+		assert(id.IsValid());
+		if (!id.IsValid()) {
+			route.Dropped++;
+			return;
+		}
+
+		auto recipientService = GetService(id.Service);
+		assert(recipientService != nullptr);
+		if (recipientService == nullptr) {
+			route.Dropped++;
+			return;
+		}
+
+		// Rewrite the recipient into the sender, so the packet can be forwarded without copying it
+		msg->m_data[0] = (uint8_t)peerMember->UnetPeer;
+		recipientService->ForwardMessage(id, msg, type, 1);
+
+		route.Packets++;
+		route.Bytes += packetSize;
+		return;
+	}
+
+	// We received a relayed packet from some client
+	if (channel >= (uint8_t)m_queuedMessages.size()) {
+		if (m_callbacks != nullptr) {
+			m_callbacks->OnLogError(strPrintF("Invalid channel index in relay packet: %d", (int)channel));
+		}
+		return;
+	}
+
+	auto memberSender = m_currentLobby->GetMember((int)peer);
+	assert(memberSender != nullptr);
+	if (memberSender == nullptr) {
+		if (m_callbacks != nullptr) {
+			m_callbacks->OnLogError(strPrintF("Received a relay packet from unknown peer %d", (int)peer));
+		}
+		return;
+	}
+
+	if (service->ReliablePacketLimit() > 0) {
+		m_reassembly.HandleMessage(memberSender->GetPrimaryServiceID(), (int)channel, msgData, packetSize);
+	} else {
+		auto newMessage = m_messagePool.AllocMessage(msgData, packetSize);
+		newMessage->m_channel = (int)channel;
+		newMessage->m_peer = memberSender->GetPrimaryServiceID();
+		QueueMessage(newMessage);
+	}
+}
+
+Unet::RelayRouteStats &Unet::Internal::Context::GetRelayRoute(int fromPeer, int toPeer)
+{
+	auto &ret = m_relayStats[(uint16_t)(((fromPeer & 0xFF) << 8) | (toPeer & 0xFF))];
+	ret.FromPeer = fromPeer;
+	ret.ToPeer = toPeer;
+	return ret;
+}
+
 void Unet::Internal::Context::PrepareReceiveBuffer(size_t size)
 {
 	if (m_receiveBuffer.size() < size) {
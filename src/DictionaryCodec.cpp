@@ -0,0 +1,262 @@
+#include <Unet_common.h>
+#include <Unet/DictionaryCodec.h>
+#include <Unet/xxhash.h>
+
+// The compressed format is the decompressed size as a varint, followed by sequences of a token byte, literals, a
+// 16 bit offset and an extended match length. The high nibble of the token is the amount of literals, the low
+// nibble is the match length minus MinMatch. A nibble of 15 is followed by extra length bytes, which are added up
+// until a byte that isn't 255. The last sequence only has literals, and ends at the end of the data.
+
+static const int HashBits = 12;
+static const size_t MinMatch = 4;
+static const size_t MaxOffset = 0xFFFF;
+
+static inline uint32_t HashSequence(const uint8_t* p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return (v * 2654435761u) >> (32 - HashBits);
+}
+
+static inline size_t MatchLength(const uint8_t* a, const uint8_t* b, const uint8_t* bEnd)
+{
+	size_t ret = 0;
+	while (b + ret < bEnd && a[ret] == b[ret]) {
+		ret++;
+	}
+	return ret;
+}
+
+static void WriteLength(std::vector<uint8_t> &out, size_t length)
+{
+	while (length >= 255) {
+		out.push_back(255);
+		length -= 255;
+	}
+	out.push_back((uint8_t)length);
+}
+
+static bool ReadLength(const uint8_t* &p, const uint8_t* end, size_t &length)
+{
+	while (true) {
+		if (p >= end) {
+			return false;
+		}
+		uint8_t b = *(p++);
+		length += b;
+		if (b != 255) {
+			return true;
+		}
+	}
+}
+
+static void WriteSequence(std::vector<uint8_t> &out, const uint8_t* literals, size_t numLiterals, size_t offset, size_t matchLength)
+{
+	size_t matchCode = matchLength > 0 ? matchLength - MinMatch : 0;
+
+	uint8_t token = (uint8_t)((std::min(numLiterals, (size_t)15) << 4) | std::min(matchCode, (size_t)15));
+	out.push_back(token);
+	if (numLiterals >= 15) {
+		WriteLength(out, numLiterals - 15);
+	}
+	out.insert(out.end(), literals, literals + numLiterals);
+
+	if (matchLength == 0) {
+		return;
+	}
+
+	out.push_back((uint8_t)(offset & 0xFF));
+	out.push_back((uint8_t)(offset >> 8));
+	if (matchCode >= 15) {
+		WriteLength(out, matchCode - 15);
+	}
+}
+
+void Unet::DictionaryCodec::SetDictionary(const uint8_t* data, size_t size)
+{
+	if (size > MaxDictionarySize) {
+		data += size - MaxDictionarySize;
+		size = MaxDictionarySize;
+	}
+
+	m_dictionary.assign(data, data + size);
+	m_dictionaryHash = size > 0 ? XXH32(data, size, 0) : 0;
+
+	m_dictionaryTable.assign((size_t)1 << HashBits, 0);
+	for (size_t i = 0; i + MinMatch <= size; i++) {
+		m_dictionaryTable[HashSequence(data + i)] = (uint32_t)(i + 1);
+	}
+}
+
+const std::vector<uint8_t> &Unet::DictionaryCodec::GetDictionary() const
+{
+	return m_dictionary;
+}
+
+uint32_t Unet::DictionaryCodec::GetDictionaryHash() const
+{
+	return m_dictionaryHash;
+}
+
+bool Unet::DictionaryCodec::HasDictionary() const
+{
+	return m_dictionary.size() > 0;
+}
+
+bool Unet::DictionaryCodec::Compress(const uint8_t* data, size_t size, std::vector<uint8_t> &out)
+{
+	out.clear();
+
+	size_t sizeLeft = size;
+	while (sizeLeft >= 0x80) {
+		out.push_back((uint8_t)(sizeLeft | 0x80));
+		sizeLeft >>= 7;
+	}
+	out.push_back((uint8_t)sizeLeft);
+
+	m_inputTable.assign((size_t)1 << HashBits, 0);
+
+	const uint8_t* dict = m_dictionary.data();
+	size_t dictSize = m_dictionary.size();
+	bool hasDictionary = m_dictionaryTable.size() > 0;
+
+	const uint8_t* end = data + size;
+	const uint8_t* literals = data;
+	const uint8_t* p = data;
+
+	while (p + MinMatch <= end) {
+		uint32_t hash = HashSequence(p);
+		size_t pos = p - data;
+
+		size_t bestLength = 0;
+		size_t bestOffset = 0;
+
+		// Candidate in the input so far
+		uint32_t candidate = m_inputTable[hash];
+		m_inputTable[hash] = (uint32_t)(pos + 1);
+		if (candidate > 0 && pos - (candidate - 1) <= MaxOffset) {
+			size_t length = MatchLength(data + candidate - 1, p, end);
+			if (length >= MinMatch) {
+				bestLength = length;
+				bestOffset = pos - (candidate - 1);
+			}
+		}
+
+		// Candidate in the dictionary, which comes right before the input
+		if (hasDictionary) {
+			candidate = m_dictionaryTable[hash];
+			size_t offset = pos + dictSize - (candidate - 1);
+			if (candidate > 0 && offset <= MaxOffset) {
+				// Matches may run from the end of the dictionary into the input
+				const uint8_t* a = dict + candidate - 1;
+				size_t length = MatchLength(a, p, std::min(end, p + (dictSize - (candidate - 1))));
+				if (length == dictSize - (candidate - 1)) {
+					length += MatchLength(data, p + length, end);
+				}
+				if (length >= MinMatch && length > bestLength) {
+					bestLength = length;
+					bestOffset = offset;
+				}
+			}
+		}
+
+		if (bestLength == 0) {
+			p++;
+			continue;
+		}
+
+		WriteSequence(out, literals, p - literals, bestOffset, bestLength);
+		if (out.size() >= size) {
+			return false;
+		}
+
+		// Index the positions that were skipped by the match
+		const uint8_t* matchEnd = p + bestLength;
+		for (p++; p < matchEnd && p + MinMatch <= end; p++) {
+			m_inputTable[HashSequence(p)] = (uint32_t)(p - data + 1);
+		}
+		p = matchEnd;
+		literals = p;
+	}
+
+	WriteSequence(out, literals, end - literals, 0, 0);
+	return out.size() < size;
+}
+
+bool Unet::DictionaryCodec::Decompress(const uint8_t* data, size_t size, std::vector<uint8_t> &out) const
+{
+	const uint8_t* p = data;
+	const uint8_t* end = data + size;
+
+	size_t rawSize = 0;
+	for (int shift = 0; ; shift += 7) {
+		if (p >= end || shift > 56) {
+			return false;
+		}
+		uint8_t b = *(p++);
+		rawSize |= (size_t)(b & 0x7F) << shift;
+		if (!(b & 0x80)) {
+			break;
+		}
+	}
+
+	// No sequence can expand to more than 256 times its own size, so this rejects bogus sizes before allocating
+	if (rawSize / 256 > (size_t)(end - p)) {
+		return false;
+	}
+
+	const uint8_t* dict = m_dictionary.data();
+	size_t dictSize = m_dictionary.size();
+
+	out.resize(rawSize);
+	size_t op = 0;
+
+	while (p < end) {
+		uint8_t token = *(p++);
+
+		size_t numLiterals = token >> 4;
+		if (numLiterals == 15 && !ReadLength(p, end, numLiterals)) {
+			return false;
+		}
+		if (numLiterals > (size_t)(end - p) || numLiterals > rawSize - op) {
+			return false;
+		}
+		if (numLiterals > 0) {
+			memcpy(out.data() + op, p, numLiterals);
+		}
+		p += numLiterals;
+		op += numLiterals;
+
+		if (p == end) {
+			break;
+		}
+
+		if (end - p < 2) {
+			return false;
+		}
+		size_t offset = p[0] | (p[1] << 8);
+		p += 2;
+
+		size_t matchLength = token & 0xF;
+		if (matchLength == 15 && !ReadLength(p, end, matchLength)) {
+			return false;
+		}
+		matchLength += MinMatch;
+
+		if (offset == 0 || offset > op + dictSize || matchLength > rawSize - op) {
+			return false;
+		}
+
+		// Copy byte by byte, as matches can overlap with their own output and can start in the dictionary
+		for (size_t i = 0; i < matchLength; i++) {
+			if (offset > op) {
+				out[op] = dict[dictSize - (offset - op)];
+			} else {
+				out[op] = out[op - offset];
+			}
+			op++;
+		}
+	}
+
+	return op == rawSize;
+}
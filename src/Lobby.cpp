@@ -48,34 +48,29 @@ const std::vector<Unet::LobbyMember*> &Unet::Lobby::GetMembers()
 
 Unet::LobbyMember* Unet::Lobby::GetMember(const xg::Guid &guid)
 {
-	for (auto member : m_members) {
-		if (member->UnetGuid == guid) {
-			return member;
-		}
+	auto it = m_membersByGuid.find(guid);
+	if (it == m_membersByGuid.end()) {
+		return nullptr;
 	}
-	return nullptr;
+	return it->second;
 }
 
 Unet::LobbyMember* Unet::Lobby::GetMember(int peer)
 {
-	for (auto member : m_members) {
-		if (member->UnetPeer == peer) {
-			return member;
-		}
+	auto it = m_membersByPeer.find(peer);
+	if (it == m_membersByPeer.end()) {
+		return nullptr;
 	}
-	return nullptr;
+	return it->second;
 }
 
 Unet::LobbyMember* Unet::Lobby::GetMember(const ServiceID &serviceId)
 {
-	for (auto member : m_members) {
-		for (auto &id : member->IDs) {
-			if (id == serviceId) {
-				return member;
-			}
-		}
+	auto it = m_membersByServiceID.find(serviceId);
+	if (it == m_membersByServiceID.end()) {
+		return nullptr;
 	}
-	return nullptr;
+	return it->second;
 }
 
 Unet::LobbyMember* Unet::Lobby::GetHostMember()
@@ -83,7 +78,7 @@ Unet::LobbyMember* Unet::Lobby::GetHostMember()
 	return GetMember(0);
 }
 
-void Unet::Lobby::HandleMessage(const ServiceID &peer, uint8_t* data, size_t size)
+void Unet::Lobby::HandleMessage(const ServiceID &peer, uint8_t* data, size_t size, bool inBatch)
 {
 	//m_ctx->GetCallbacks()->OnLogDebug(strPrintF("Handle lobby message of %d bytes", (int)size));
 
@@ -150,7 +145,9 @@ void Unet::Lobby::HandleMessage(const ServiceID &peer, uint8_t* data, size_t siz
 				js["members"].emplace_back(member->Serialize());
 			}
 		}
-		m_ctx->InternalSendTo(member, js);
+		// The compression dictionary is sent along as binary data, if there is one
+		auto &dictionary = m_ctx->m_dictionaryCodec.GetDictionary();
+		m_ctx->InternalSendTo(member, js, (uint8_t*)dictionary.data(), dictionary.size());
 
 		// Send MemberInfo to existing members
 		js = member->Serialize();
@@ -180,6 +177,9 @@ void Unet::Lobby::HandleMessage(const ServiceID &peer, uint8_t* data, size_t siz
 		}
 
 		DeserializeData(js["data"]);
+		if (binarySize > 0) {
+			m_ctx->m_dictionaryCodec.SetDictionary(binaryData, binarySize);
+		}
 		m_info.Name = GetData("unet-name");
 		m_info.UnetGuid = xg::Guid(GetData("unet-guid"));
 
@@ -372,9 +372,10 @@ void Unet::Lobby::HandleMessage(const ServiceID &peer, uint8_t* data, size_t siz
 		auto filename = js["filename"].get<std::string>();
 		auto size = js["size"].get<size_t>();
 		auto hash = js["hash"].get<uint64_t>();
+		auto chunks = js.value("chunks", std::vector<uint64_t>());
 
 		auto newFile = new LobbyFile(filename);
-		newFile->Prepare(size, hash);
+		newFile->Prepare(size, hash, chunks);
 		newFile->LoadFromCache();
 
 		if (m_info.IsHosting) {
@@ -386,6 +387,7 @@ void Unet::Lobby::HandleMessage(const ServiceID &peer, uint8_t* data, size_t siz
 			js["filename"] = filename;
 			js["size"] = size;
 			js["hash"] = hash;
+			js["chunks"] = newFile->m_chunkHashes;
 			m_ctx->InternalSendToAllExcept(peerMember, js);
 
 			m_ctx->GetCallbacks()->OnLobbyFileAdded(peerMember, newFile);
@@ -448,28 +450,98 @@ void Unet::Lobby::HandleMessage(const ServiceID &peer, uint8_t* data, size_t siz
 
 		m_ctx->GetCallbacks()->OnLobbyFileRequested(peerMember, file);
 
+		// The binary data is a bitmap of the chunks the member doesn't need from us, because they already have them or
+		// are getting them from someone else
 		OutgoingFileTransfer newTransfer;
 		newTransfer.FileHash = file->m_hash;
 		newTransfer.MemberPeer = peerMember->UnetPeer;
-		m_outgoingFileTransfers.emplace_back(newTransfer);
+		for (size_t i = 0; i < file->GetChunkCount(); i++) {
+			if (i / 8 < binarySize && (binaryData[i / 8] & (1 << (i % 8)))) {
+				newTransfer.CurrentPos += file->GetChunkSize(i);
+			} else {
+				newTransfer.Chunks.emplace_back((uint32_t)i);
+			}
+		}
+
+		// A new request for the same file replaces the old one, as it's sent when resuming a transfer
+		auto it = std::find_if(m_outgoingFileTransfers.begin(), m_outgoingFileTransfers.end(), [&newTransfer](const OutgoingFileTransfer &transfer) {
+			return transfer.FileHash == newTransfer.FileHash && transfer.MemberPeer == newTransfer.MemberPeer;
+		});
+		if (it != m_outgoingFileTransfers.end()) {
+			*it = std::move(newTransfer);
+		} else {
+			m_outgoingFileTransfers.emplace_back(std::move(newTransfer));
+		}
 
 	} else if (type == LobbyPacketType::LobbyFileData) {
 		auto filename = js["filename"].get<std::string>();
 
-		auto file = peerMember->GetFile(filename);
-		if (file == nullptr) {
+		auto sourceFile = peerMember->GetFile(filename);
+		if (sourceFile == nullptr) {
 			m_ctx->GetCallbacks()->OnLogWarn(strPrintF("Peer %d sent us data for file \"%s\" which they don't have!", (int)peerMember->UnetPeer, filename.c_str()));
 			return;
 		}
 
-		//TODO: Verify that we actually requested this file
+		// Chunks that were still underway from other members when a download finished end up here as well, so
+		// data we didn't ask for is dropped silently
+		auto transfer = GetIncomingFileTransfer(sourceFile->m_hash);
+		if (transfer == nullptr) {
+			return;
+		}
+
+		// The data is written to the file that was requested, which is not necessarily the file of this member
+		auto requestedMember = GetMember(transfer->MemberPeer);
+		auto file = (requestedMember != nullptr ? requestedMember->GetFile(transfer->FileHash) : nullptr);
+		if (file == nullptr) {
+			return;
+		}
+
+		auto source = std::find_if(transfer->Sources.begin(), transfer->Sources.end(), [peerMember](const IncomingFileTransfer::Source &source) {
+			return source.MemberPeer == peerMember->UnetPeer;
+		});
+
+		auto chunk = js["chunk"].get<size_t>();
+		bool last = js.value("last", false);
+		size_t availableSize = file->m_availableSize;
+
+		if (!file->VerifyChunk(chunk, binaryData, binarySize)) {
+			m_ctx->GetCallbacks()->OnLogWarn(strPrintF("Peer %d sent us chunk %d of file \"%s\" which doesn't match its hash!", (int)peerMember->UnetPeer, (int)chunk, filename.c_str()));
+
+		} else if (!file->WriteChunk(chunk, binaryData, binarySize)) {
+			m_ctx->GetCallbacks()->OnLogError(strPrintF("Couldn't write data for file \"%s\" to the cache!", file->m_filename.c_str()));
+			return;
+		}
 
-		file->AppendData(binaryData, binarySize);
+		if (source != transfer->Sources.end()) {
+			source->ChunksReceived++;
+			source->LastActivity = std::chrono::steady_clock::now();
+		}
 
-		m_ctx->GetCallbacks()->OnLobbyFileDataReceiveProgress(peerMember, file);
-		if (file->m_availableSize == file->m_size) {
-			m_ctx->GetCallbacks()->OnLobbyFileDataReceiveFinished(peerMember, file, file->IsValid());
-			file->SaveToCache();
+		if (file->m_availableSize != availableSize) {
+			m_ctx->GetCallbacks()->OnLobbyFileDataReceiveProgress(peerMember, file);
+
+			if (file->m_availableSize == file->m_size) {
+				m_incomingFileTransfers.erase(m_incomingFileTransfers.begin() + (transfer - m_incomingFileTransfers.data()));
+
+				bool isValid = file->IsValid();
+				m_ctx->GetCallbacks()->OnLobbyFileDataReceiveFinished(peerMember, file, isValid);
+				if (isValid) {
+					file->SaveToCache();
+
+					// Other members sharing the same file can now be served from the cache as well
+					for (auto member : m_members) {
+						auto otherFile = member->GetFile(file->m_hash);
+						if (otherFile != nullptr && otherFile != file && otherFile->m_availableSize == 0) {
+							otherFile->LoadFromCache();
+						}
+					}
+				}
+				return;
+			}
+		}
+
+		if (last && source != transfer->Sources.end()) {
+			EndIncomingFileBatch(*transfer, *source, file);
 		}
 
 	} else if (type == LobbyPacketType::LobbyChatMessage) {
@@ -496,6 +568,83 @@ void Unet::Lobby::HandleMessage(const ServiceID &peer, uint8_t* data, size_t siz
 			m_ctx->GetCallbacks()->OnLobbyChat(member, text.c_str());
 		}
 
+	} else if (type == LobbyPacketType::Batch) {
+		// Batches are never nested when sending, and recursing into nested ones could overflow the stack
+		if (inBatch) {
+			m_ctx->GetCallbacks()->OnLogError(strPrintF("[P2P] [%s] Batch from 0x%016llX contains another batch!", GetServiceNameByType(peer.Service), peer.ID));
+			return;
+		}
+
+		uint8_t* p = binaryData;
+		size_t bytesLeft = binarySize;
+
+		while (bytesLeft >= 4) {
+			uint32_t msgSize = *(uint32_t*)p;
+			p += 4;
+			bytesLeft -= 4;
+
+			if (msgSize > bytesLeft) {
+				m_ctx->GetCallbacks()->OnLogError(strPrintF("[P2P] [%s] Batch from 0x%016llX is truncated!", GetServiceNameByType(peer.Service), peer.ID));
+				break;
+			}
+
+			HandleMessage(peer, p, msgSize, true);
+
+			p += msgSize;
+			bytesLeft -= msgSize;
+		}
+
+	} else if (type == LobbyPacketType::LobbyCompressionDictionary) {
+		if (m_info.IsHosting) {
+			return;
+		}
+
+		m_ctx->m_dictionaryCodec.SetDictionary(binaryData, binarySize);
+
+	} else if (type == LobbyPacketType::LobbyDataBatch) {
+		if (m_info.IsHosting) {
+			// Clients may only change their own member data, which we collect and send out with our next flush
+			if (!js.contains("members")) {
+				return;
+			}
+
+			for (auto &jsMember : js["members"]) {
+				auto changed = peerMember->ApplyDataChanges(jsMember, true);
+				for (auto &name : changed) {
+					m_ctx->GetCallbacks()->OnLobbyMemberDataChanged(peerMember, name);
+				}
+			}
+			return;
+		}
+
+		if (js.contains("name")) {
+			SetName(js["name"].get<std::string>());
+		}
+
+		if (js.contains("lobby")) {
+			auto changed = ApplyDataChanges(js["lobby"]);
+			for (auto &name : changed) {
+				m_ctx->GetCallbacks()->OnLobbyDataChanged(name);
+			}
+		}
+
+		if (js.contains("members")) {
+			for (auto &jsMember : js["members"]) {
+				xg::Guid guid(jsMember["guid"].get<std::string>());
+
+				auto member = GetMember(guid);
+				assert(member != nullptr);
+				if (member == nullptr) {
+					continue;
+				}
+
+				auto changed = member->ApplyDataChanges(jsMember);
+				for (auto &name : changed) {
+					m_ctx->GetCallbacks()->OnLobbyMemberDataChanged(member, name);
+				}
+			}
+		}
+
 	} else {
 		m_ctx->GetCallbacks()->OnLogWarn(strPrintF("P2P packet type was not recognized: %d", (int)type));
 	}
@@ -515,7 +664,9 @@ Unet::LobbyMember* Unet::Lobby::DeserializeMember(const json &member)
 	auto lobbyMember = GetMember(guid);
 	assert(lobbyMember != nullptr); // If this fails, there's no service IDs given for this member
 
+	int oldPeer = lobbyMember->UnetPeer;
 	lobbyMember->Deserialize(member);
+	ReindexMemberPeer(lobbyMember, oldPeer);
 
 	return lobbyMember;
 }
@@ -547,7 +698,9 @@ void Unet::Lobby::ServiceDisconnected(ServiceType service)
 
 	m_info.EntryPoints.erase(it);
 
-	for (auto member : m_members) {
+	// Copy the member list, as removing the last service of a member removes it from the list
+	auto members = m_members;
+	for (auto member : members) {
 		for (int i = (int)member->IDs.size() - 1; i >= 0; i--) {
 			if (member->IDs[i].Service == service) {
 				RemoveMemberService(member->IDs[i]);
@@ -570,51 +723,32 @@ void Unet::Lobby::ServiceDisconnected(ServiceType service)
 
 Unet::LobbyMember* Unet::Lobby::AddMemberService(const xg::Guid &guid, const ServiceID &id)
 {
-	for (size_t i = 0; i < m_members.size(); i++) {
-		bool foundMember = false;
-		auto member = m_members[i];
+	auto existingMember = GetMember(id);
+	if (existingMember != nullptr && existingMember->UnetGuid != guid) {
+		auto strGuid = guid.str();
+		auto strExistingGuid = existingMember->UnetGuid.str();
 
-		if (member->UnetGuid == guid) {
-			continue;
-		}
+		m_ctx->GetCallbacks()->OnLogWarn(strPrintF("Tried adding %s ID 0x%016llX to member with guid %s, but another member with guid %s already has this ID! Assuming existing member is no longer connected, removing from member list.",
+			GetServiceNameByType(id.Service), id.ID,
+			strGuid.c_str(), strExistingGuid.c_str()
+		));
 
-		for (auto &memberId : member->IDs) {
-			if (memberId != id) {
-				continue;
-			}
+		EraseMember(existingMember);
+	}
 
+	auto member = GetMember(guid);
+	if (member != nullptr) {
+		auto existingId = member->GetServiceID(id.Service);
+		if (existingId.IsValid()) {
 			auto strGuid = guid.str();
-			auto strExistingGuid = member->UnetGuid.str();
-
-			m_ctx->GetCallbacks()->OnLogWarn(strPrintF("Tried adding %s ID 0x%016llX to member with guid %s, but another member with guid %s already has this ID! Assuming existing member is no longer connected, removing from member list.",
-				GetServiceNameByType(id.Service), id.ID,
-				strGuid.c_str(), strExistingGuid.c_str()
+			m_ctx->GetCallbacks()->OnLogWarn(strPrintF("Tried adding player service %s for guid %s, but it already exists!",
+				GetServiceNameByType(id.Service), strGuid.c_str()
 			));
-
-			m_members.erase(m_members.begin() + i);
-			m_info.NumPlayers--;
-			foundMember = true;
-			break;
-		}
-
-		if (foundMember) {
-			break;
-		}
-	}
-
-	for (auto member : m_members) {
-		if (member->UnetGuid == guid) {
-			auto existingId = member->GetServiceID(id.Service);
-			if (existingId.IsValid()) {
-				auto strGuid = guid.str();
-				m_ctx->GetCallbacks()->OnLogWarn(strPrintF("Tried adding player service %s for guid %s, but it already exists!",
-					GetServiceNameByType(id.Service), strGuid.c_str()
-				));
-			} else {
-				member->IDs.emplace_back(id);
-			}
-			return member;
+		} else {
+			member->IDs.emplace_back(id);
+			m_membersByServiceID[id] = member;
 		}
+		return member;
 	}
 
 	auto newMember = new LobbyMember(m_ctx);
@@ -622,8 +756,7 @@ Unet::LobbyMember* Unet::Lobby::AddMemberService(const xg::Guid &guid, const Ser
 	newMember->UnetGuid = guid;
 	newMember->UnetPeer = GetNextAvailablePeer();
 	newMember->IDs.emplace_back(id);
-	m_members.emplace_back(newMember);
-	m_info.NumPlayers++;
+	InsertMember(newMember);
 
 	return newMember;
 }
@@ -642,12 +775,11 @@ void Unet::Lobby::RemoveMemberService(const ServiceID &id)
 	}
 
 	member->IDs.erase(it);
+	m_membersByServiceID.erase(id);
+	m_ctx->m_reassembly.ClearPeer(id);
+
 	if (member->IDs.size() == 0) {
-		auto itMember = std::find(m_members.begin(), m_members.end(), member);
-		if (itMember != m_members.end()) {
-			m_members.erase(itMember);
-			m_info.NumPlayers--;
-		}
+		EraseMember(member);
 
 		m_ctx->OnLobbyPlayerLeft(member);
 		delete member;
@@ -656,11 +788,9 @@ void Unet::Lobby::RemoveMemberService(const ServiceID &id)
 
 void Unet::Lobby::RemoveMember(LobbyMember* member)
 {
-	auto it = std::find(m_members.begin(), m_members.end(), member);
-	assert(it != m_members.end());
+	assert(std::find(m_members.begin(), m_members.end(), member) != m_members.end());
 
-	m_members.erase(it);
-	m_info.NumPlayers--;
+	EraseMember(member);
 
 	m_ctx->OnLobbyPlayerLeft(member);
 	delete member;
@@ -675,7 +805,12 @@ void Unet::Lobby::SetName(const std::string &name)
 	std::string oldname = m_info.Name;
 	m_info.Name = name;
 
-	if (m_info.IsHosting) {
+	if (m_info.IsHosting && m_batchData) {
+		m_namePending = true;
+
+	} else if (m_info.IsHosting) {
+		m_namePending = false;
+
 		for (auto &entryPoint : m_info.EntryPoints) {
 			auto service = m_ctx->GetService(entryPoint.Service);
 			assert(service != nullptr);
@@ -759,18 +894,24 @@ void Unet::Lobby::SetData(const std::string &name, const std::string &value)
 	LobbyDataContainer::SetData(name, value);
 
 	if (m_info.IsHosting) {
-		for (auto &entry : m_info.EntryPoints) {
-			auto service = m_ctx->GetService(entry.Service);
-			if (service != nullptr) {
-				service->SetLobbyData(entry, name.c_str(), value.c_str());
+		if (m_batchData) {
+			RecordDataChange(name, value, false);
+		} else {
+			m_pendingChanges.erase(name);
+
+			for (auto &entry : m_info.EntryPoints) {
+				auto service = m_ctx->GetService(entry.Service);
+				if (service != nullptr) {
+					service->SetLobbyData(entry, name.c_str(), value.c_str());
+				}
 			}
-		}
 
-		json js;
-		js["t"] = (uint8_t)LobbyPacketType::LobbyData;
-		js["name"] = name;
-		js["value"] = value;
-		m_ctx->InternalSendToAll(js);
+			json js;
+			js["t"] = (uint8_t)LobbyPacketType::LobbyData;
+			js["name"] = name;
+			js["value"] = value;
+			m_ctx->InternalSendToAll(js);
+		}
 
 		m_ctx->GetCallbacks()->OnLobbyDataChanged(name);
 	}
@@ -818,6 +959,13 @@ void Unet::Lobby::RemoveData(const std::string &name)
 	LobbyDataContainer::RemoveData(name);
 
 	if (m_info.IsHosting) {
+		if (m_batchData) {
+			RecordDataChange(name, "", true);
+			return;
+		}
+
+		m_pendingChanges.erase(name);
+
 		for (auto &entry : m_info.EntryPoints) {
 			auto service = m_ctx->GetService(entry.Service);
 			if (service != nullptr) {
@@ -832,18 +980,154 @@ void Unet::Lobby::RemoveData(const std::string &name)
 	}
 }
 
+void Unet::Lobby::FlushDataChanges()
+{
+	if (!m_info.IsHosting) {
+		auto localMember = GetMember(m_ctx->m_localPeer);
+		if (localMember == nullptr || !localMember->HasPendingDataChanges()) {
+			return;
+		}
+
+		json js;
+		js["t"] = (uint8_t)LobbyPacketType::LobbyDataBatch;
+		js["members"] = json::array();
+		js["members"].emplace_back(localMember->SerializeDataChanges());
+		m_ctx->InternalSendToHost(js);
+		return;
+	}
+
+	json js = json::object();
+
+	if (HasPendingDataChanges()) {
+		for (auto &entry : m_info.EntryPoints) {
+			auto service = m_ctx->GetService(entry.Service);
+			if (service == nullptr) {
+				continue;
+			}
+
+			for (auto &pair : m_pendingChanges) {
+				if (pair.second.Removed) {
+					service->RemoveLobbyData(entry, pair.first.c_str());
+				} else {
+					service->SetLobbyData(entry, pair.first.c_str(), pair.second.Value.c_str());
+				}
+			}
+		}
+
+		js["lobby"] = SerializeDataChanges();
+	}
+
+	if (m_namePending) {
+		for (auto &entry : m_info.EntryPoints) {
+			auto service = m_ctx->GetService(entry.Service);
+			if (service != nullptr) {
+				service->SetLobbyData(entry, "unet-name", m_info.Name.c_str());
+			}
+		}
+
+		js["name"] = m_info.Name;
+		m_namePending = false;
+	}
+
+	for (auto member : m_members) {
+		if (!member->HasPendingDataChanges()) {
+			continue;
+		}
+
+		json jsMember = member->SerializeDataChanges();
+		jsMember["guid"] = member->UnetGuid.str();
+
+		if (!js.contains("members")) {
+			js["members"] = json::array();
+		}
+		js["members"].emplace_back(jsMember);
+	}
+
+	if (js.size() == 0) {
+		return;
+	}
+
+	js["t"] = (uint8_t)LobbyPacketType::LobbyDataBatch;
+	m_ctx->InternalSendToAll(js);
+}
+
 int Unet::Lobby::GetNextAvailablePeer()
 {
 	int i = 0;
-	while (GetMember(i) != nullptr) {
+	while (m_membersByPeer.find(i) != m_membersByPeer.end()) {
 		i++;
 	}
 	return i;
 }
 
+void Unet::Lobby::InsertMember(LobbyMember* member)
+{
+	m_members.emplace_back(member);
+	m_info.NumPlayers++;
+
+	m_membersByGuid[member->UnetGuid] = member;
+	m_membersByPeer[member->UnetPeer] = member;
+	for (auto &id : member->IDs) {
+		m_membersByServiceID[id] = member;
+	}
+}
+
+void Unet::Lobby::EraseMember(LobbyMember* member)
+{
+	auto it = std::find(m_members.begin(), m_members.end(), member);
+	if (it == m_members.end()) {
+		return;
+	}
+
+	m_members.erase(it);
+	m_info.NumPlayers--;
+
+	auto itGuid = m_membersByGuid.find(member->UnetGuid);
+	if (itGuid != m_membersByGuid.end() && itGuid->second == member) {
+		m_membersByGuid.erase(itGuid);
+	}
+
+	auto itPeer = m_membersByPeer.find(member->UnetPeer);
+	if (itPeer != m_membersByPeer.end() && itPeer->second == member) {
+		m_membersByPeer.erase(itPeer);
+	}
+
+	for (auto &id : member->IDs) {
+		auto itId = m_membersByServiceID.find(id);
+		if (itId != m_membersByServiceID.end() && itId->second == member) {
+			m_membersByServiceID.erase(itId);
+		}
+	}
+}
+
+void Unet::Lobby::ReindexMemberPeer(LobbyMember* member, int oldPeer)
+{
+	if (member->UnetPeer == oldPeer) {
+		return;
+	}
+
+	auto it = m_membersByPeer.find(oldPeer);
+	if (it != m_membersByPeer.end() && it->second == member) {
+		m_membersByPeer.erase(it);
+	}
+	m_membersByPeer[member->UnetPeer] = member;
+}
+
 void Unet::Lobby::HandleOutgoingFileTransfers()
 {
 	auto localMember = GetMember(m_ctx->m_localPeer);
+	auto now = std::chrono::steady_clock::now();
+
+	// The bandwidth limit is shared by all transfers, and allows bursts of up to a quarter of a second
+	if (m_ctx->m_fileBandwidthLimit > 0) {
+		double limit = (double)m_ctx->m_fileBandwidthLimit;
+		std::chrono::duration<double> elapsed = now - m_lastFileSend;
+		m_fileSendBudget = std::min(std::max(limit * 0.25, (double)LobbyFile::ChunkSize), m_fileSendBudget + limit * elapsed.count());
+	}
+	m_lastFileSend = now;
+
+	// Multiple transfers to the same member share what their connection can take this tick
+	std::unordered_map<int, size_t> allowances;
 
 	for (int i = (int)m_outgoingFileTransfers.size() - 1; i >= 0; i--) {
 		auto &transfer = m_outgoingFileTransfers[i];
@@ -857,37 +1141,302 @@ void Unet::Lobby::HandleOutgoingFileTransfers()
 			continue;
 		}
 
-		// We use a relatively small block size to avoid making the download progress indicator too slow,
+		// Blocks are whole chunks, which are small enough to avoid making the download progress indicator too slow,
 		// as well as making sure we're under the reliable packet size limit in most cases.
-		const size_t blockSize = 1024 * 64;
-		const int maxBlocks = 3;
+		// Chunks are read from the file as they're sent, so only a single chunk is ever held in memory
+		if (m_fileBlock.size() < LobbyFile::ChunkSize) {
+			m_fileBlock.resize(LobbyFile::ChunkSize);
+		}
+
+		auto itAllowance = allowances.find(member->UnetPeer);
+		if (itAllowance == allowances.end()) {
+			itAllowance = allowances.emplace(member->UnetPeer, GetFileSendAllowance(member, now)).first;
+		}
+		size_t &allowance = itAllowance->second;
 
-		uint8_t* p = file->m_buffer + transfer.CurrentPos;
-		size_t bytesLeft = file->m_size - transfer.CurrentPos;
+		bool readFailed = false;
 		int numBlocks = 0;
 
-		json js;
-		js["t"] = (uint8_t)LobbyPacketType::LobbyFileData;
-		js["filename"] = file->m_filename;
+		while (transfer.NextChunk < transfer.Chunks.size()) {
+			uint32_t chunk = transfer.Chunks[transfer.NextChunk];
+			size_t chunkSize = file->GetChunkSize(chunk);
+
+			if (chunkSize > allowance || (m_ctx->m_fileBandwidthLimit > 0 && m_fileSendBudget <= 0.0)) {
+				break;
+			}
+
+			if (chunkSize == 0 || file->ReadData(chunk * LobbyFile::ChunkSize, m_fileBlock.data(), chunkSize) != chunkSize) {
+				m_ctx->GetCallbacks()->OnLogError(strPrintF("Couldn't read data from file \"%s\"!", file->m_filename.c_str()));
+				readFailed = true;
+				break;
+			}
 
-		for (int i = 0; i < maxBlocks && bytesLeft > 0; i++) {
-			size_t sendSize = std::min(blockSize, bytesLeft);
+			transfer.NextChunk++;
 
-			m_ctx->InternalSendTo(member, js, p, sendSize);
+			json js;
+			js["t"] = (uint8_t)LobbyPacketType::LobbyFileData;
+			js["filename"] = file->m_filename;
+			js["chunk"] = chunk;
+			if (transfer.NextChunk == transfer.Chunks.size()) {
+				js["last"] = true;
+			}
+			m_ctx->InternalSendFileData(member, js, m_fileBlock.data(), chunkSize);
 
-			p += sendSize;
-			transfer.CurrentPos += sendSize;
+			transfer.CurrentPos += chunkSize;
 			numBlocks++;
 
-			bytesLeft -= sendSize;
+			allowance -= chunkSize;
+			m_fileSendBudget -= (double)chunkSize;
+			m_fileSendPacing[member->UnetPeer].Sent += chunkSize;
 		}
 
-		m_ctx->GetCallbacks()->OnLobbyFileDataSendProgress(transfer);
+		if (readFailed) {
+			m_outgoingFileTransfers.erase(m_outgoingFileTransfers.begin() + i);
+			continue;
+		}
 
-		if (transfer.CurrentPos == file->m_availableSize) {
+		if (numBlocks > 0) {
+			m_ctx->GetCallbacks()->OnLobbyFileDataSendProgress(transfer);
+		}
+
+		if (transfer.NextChunk == transfer.Chunks.size()) {
 			m_ctx->GetCallbacks()->OnLobbyFileDataSendFinished(transfer);
 
 			m_outgoingFileTransfers.erase(m_outgoingFileTransfers.begin() + i);
 		}
 	}
+
+	if (m_outgoingFileTransfers.size() == 0) {
+		m_fileSendPacing.clear();
+	}
+}
+
+size_t Unet::Lobby::GetFileSendAllowance(LobbyMember* member, std::chrono::steady_clock::time_point now)
+{
+	// Anything queued beyond what the connection delivers in a round trip plus this many seconds only delays the
+	// gameplay traffic sent after it, so file data just fills up the space that other traffic leaves over
+	const double targetQueueDelay = 0.05;
+	const size_t minWindow = LobbyFile::ChunkSize * 2;
+	const size_t maxWindow = LobbyFile::ChunkSize * 64;
+	// Used for services that can't tell us how much is queued
+	const size_t fallbackChunksPerTick = 3;
+
+	auto id = member->GetDataServiceID();
+	auto service = m_ctx->GetService(id.Service);
+
+	ConnectionStatus status;
+	if (service == nullptr || !service->GetConnectionStatus(id, status)) {
+		return fallbackChunksPerTick * LobbyFile::ChunkSize;
+	}
+
+	auto &pacing = m_fileSendPacing[member->UnetPeer];
+
+	// Whatever we expected to be pending but isn't anymore has been delivered since the last tick
+	std::chrono::duration<double> elapsed = now - pacing.LastCheck;
+	if (pacing.LastCheck != std::chrono::steady_clock::time_point() && elapsed.count() > 0.0) {
+		size_t expected = pacing.LastPending + pacing.Sent;
+		size_t delivered = (expected > status.PendingReliableBytes ? expected - status.PendingReliableBytes : 0);
+		pacing.Rate = pacing.Rate * 0.75 + (delivered / elapsed.count()) * 0.25;
+	}
+
+	pacing.LastCheck = now;
+	pacing.LastPending = status.PendingReliableBytes;
+	pacing.Sent = 0;
+
+	double window = pacing.Rate * (status.RoundTripTime / 1000.0 + targetQueueDelay);
+	size_t windowSize = std::min(maxWindow, std::max(minWindow, (size_t)window));
+
+	if (status.PendingReliableBytes >= windowSize) {
+		return 0;
+	}
+	return windowSize - status.PendingReliableBytes;
+}
+
+void Unet::Lobby::StartIncomingFileTransfer(LobbyMember* member, LobbyFile* file)
+{
+	if (GetIncomingFileTransfer(file->m_hash) != nullptr) {
+		m_ctx->GetCallbacks()->OnLogWarn(strPrintF("File \"%s\" is already being downloaded!", file->m_filename.c_str()));
+		return;
+	}
+
+	// The sources are picked up on the next tick
+	IncomingFileTransfer newTransfer;
+	newTransfer.FileHash = file->m_hash;
+	newTransfer.MemberPeer = member->UnetPeer;
+	newTransfer.ChunksRequested.assign(file->GetChunkCount(), false);
+	m_incomingFileTransfers.emplace_back(std::move(newTransfer));
+}
+
+Unet::IncomingFileTransfer* Unet::Lobby::GetIncomingFileTransfer(uint64_t hash)
+{
+	for (auto &transfer : m_incomingFileTransfers) {
+		if (transfer.FileHash == hash) {
+			return &transfer;
+		}
+	}
+	return nullptr;
+}
+
+void Unet::Lobby::HandleIncomingFileTransfers()
+{
+	// Batches are sized to take about a second at the rate the member delivered their last batch at, so faster
+	// members are asked for more chunks at a time
+	const size_t initialBatchChunks = 8;
+	const size_t minBatchChunks = 4;
+	const size_t maxBatchChunks = 64;
+	const double batchDuration = 1.0;
+	const auto batchTimeout = std::chrono::seconds(30);
+
+	auto now = std::chrono::steady_clock::now();
+
+	for (int i = (int)m_incomingFileTransfers.size() - 1; i >= 0; i--) {
+		auto &transfer = m_incomingFileTransfers[i];
+
+		auto requestedMember = GetMember(transfer.MemberPeer);
+		auto file = (requestedMember != nullptr ? requestedMember->GetFile(transfer.FileHash) : nullptr);
+
+		if (file == nullptr) {
+			//TODO: Run callback about canceled incoming file transfer
+			m_incomingFileTransfers.erase(m_incomingFileTransfers.begin() + i);
+			continue;
+		}
+
+		// Give up on batches that stopped arriving, and drop sources that left, removed the file, became unreachable
+		// or failed too often
+		for (int j = (int)transfer.Sources.size() - 1; j >= 0; j--) {
+			auto &source = transfer.Sources[j];
+
+			auto member = GetMember(source.MemberPeer);
+			if (member != nullptr && !source.Chunks.empty() && now - source.LastActivity > batchTimeout) {
+				m_ctx->GetCallbacks()->OnLogWarn(strPrintF("Peer %d stopped sending data for file \"%s\"", (int)member->UnetPeer, file->m_filename.c_str()));
+				EndIncomingFileBatch(transfer, source, file);
+			}
+
+			if (source.Failures > LobbyFile::MaxRetries) {
+				m_ctx->GetCallbacks()->OnLogWarn(strPrintF("Not downloading file \"%s\" from peer %d anymore, as they failed too often", file->m_filename.c_str(), source.MemberPeer));
+				transfer.FailedSources.emplace_back(source.MemberPeer);
+
+			} else if (member != nullptr && IsFileSource(member, transfer.FileHash)) {
+				continue;
+			}
+
+			for (auto chunk : source.Chunks) {
+				transfer.ChunksRequested[chunk] = false;
+			}
+			transfer.Sources.erase(transfer.Sources.begin() + j);
+		}
+
+		// Anyone sharing a file with the same hash can be downloaded from
+		for (auto member : m_members) {
+			if (!IsFileSource(member, transfer.FileHash)) {
+				continue;
+			}
+
+			if (std::find(transfer.FailedSources.begin(), transfer.FailedSources.end(), member->UnetPeer) != transfer.FailedSources.end()) {
+				continue;
+			}
+
+			auto it = std::find_if(transfer.Sources.begin(), transfer.Sources.end(), [member](const IncomingFileTransfer::Source &source) {
+				return source.MemberPeer == member->UnetPeer;
+			});
+
+			if (it == transfer.Sources.end()) {
+				IncomingFileTransfer::Source newSource;
+				newSource.MemberPeer = member->UnetPeer;
+				transfer.Sources.emplace_back(newSource);
+			}
+		}
+
+		if (transfer.Sources.empty()) {
+			m_incomingFileTransfers.erase(m_incomingFileTransfers.begin() + i);
+			m_ctx->GetCallbacks()->OnLobbyFileDataReceiveFinished(requestedMember, file, false);
+			continue;
+		}
+
+		// Idle members get a new batch, fastest first
+		std::vector<IncomingFileTransfer::Source*> idleSources;
+		for (auto &source : transfer.Sources) {
+			if (source.Chunks.empty()) {
+				idleSources.emplace_back(&source);
+			}
+		}
+
+		std::sort(idleSources.begin(), idleSources.end(), [](const IncomingFileTransfer::Source* a, const IncomingFileTransfer::Source* b) {
+			return a->Rate > b->Rate;
+		});
+
+		size_t numChunks = file->GetChunkCount();
+		size_t nextChunk = 0;
+
+		for (auto source : idleSources) {
+			size_t batchChunks = initialBatchChunks;
+			if (source->Rate > 0.0) {
+				batchChunks = std::min(maxBatchChunks, std::max(minBatchChunks, (size_t)(source->Rate * batchDuration)));
+			}
+
+			for (; nextChunk < numChunks && source->Chunks.size() < batchChunks; nextChunk++) {
+				if (!file->HasChunk(nextChunk) && !transfer.ChunksRequested[nextChunk]) {
+					source->Chunks.emplace_back((uint32_t)nextChunk);
+					transfer.ChunksRequested[nextChunk] = true;
+				}
+			}
+
+			if (source->Chunks.empty()) {
+				break;
+			}
+
+			source->ChunksReceived = 0;
+			source->BatchStart = now;
+			source->LastActivity = now;
+
+			// The bitmap tells the member which chunks to skip, which is everything outside of the batch
+			std::vector<uint8_t> bitmap((numChunks + 7) / 8, 0xFF);
+			for (auto chunk : source->Chunks) {
+				bitmap[chunk / 8] &= ~(1 << (chunk % 8));
+			}
+
+			auto member = GetMember(source->MemberPeer);
+			auto sourceFile = member->GetFile(transfer.FileHash);
+
+			json js;
+			js["t"] = (uint8_t)LobbyPacketType::LobbyFileRequested;
+			js["filename"] = sourceFile->m_filename;
+			m_ctx->InternalSendTo(member, js, bitmap.data(), bitmap.size());
+		}
+	}
+}
+
+bool Unet::Lobby::IsFileSource(LobbyMember* member, uint64_t hash)
+{
+	if (member->UnetPeer == m_ctx->m_localPeer || member->GetFile(hash) == nullptr) {
+		return false;
+	}
+
+	// File data is sent directly, so members we can only reach through the host can't be downloaded from
+	auto id = member->GetDataServiceID();
+	return id.IsValid() && m_ctx->GetService(id.Service) != nullptr;
+}
+
+void Unet::Lobby::EndIncomingFileBatch(IncomingFileTransfer &transfer, IncomingFileTransfer::Source &source, LobbyFile* file)
+{
+	// Chunks that were corrupt or never arrived go back to the pool, to be requested from whoever is idle next
+	bool missing = false;
+	for (auto chunk : source.Chunks) {
+		transfer.ChunksRequested[chunk] = false;
+		if (!file->HasChunk(chunk)) {
+			missing = true;
+		}
+	}
+
+	if (missing) {
+		source.Failures++;
+	}
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - source.BatchStart;
+	if (source.ChunksReceived > 0 && elapsed.count() > 0.0) {
+		source.Rate = source.ChunksReceived / elapsed.count();
+	}
+
+	source.Chunks.clear();
+	source.ChunksReceived = 0;
 }
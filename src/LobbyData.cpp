@@ -87,3 +87,70 @@ void Unet::LobbyDataContainer::InternalRemoveData(const std::string &name)
 		m_data.erase(it);
 	}
 }
+
+void Unet::LobbyDataContainer::SetDataBatching(bool enabled)
+{
+	m_batchData = enabled;
+}
+
+bool Unet::LobbyDataContainer::IsDataBatching() const
+{
+	return m_batchData;
+}
+
+bool Unet::LobbyDataContainer::HasPendingDataChanges() const
+{
+	return m_pendingChanges.size() > 0;
+}
+
+void Unet::LobbyDataContainer::RecordDataChange(const std::string &name, const std::string &value, bool removed)
+{
+	auto &change = m_pendingChanges[name];
+	change.Removed = removed;
+	change.Value = value;
+}
+
+json Unet::LobbyDataContainer::SerializeDataChanges()
+{
+	json ret = json::object();
+	ret["set"] = json::object();
+	ret["remove"] = json::array();
+
+	for (auto &pair : m_pendingChanges) {
+		if (pair.second.Removed) {
+			ret["remove"].emplace_back(pair.first);
+		} else {
+			ret["set"][pair.first] = pair.second.Value;
+		}
+	}
+
+	m_pendingChanges.clear();
+	return ret;
+}
+
+std::vector<std::string> Unet::LobbyDataContainer::ApplyDataChanges(const json &js, bool record)
+{
+	std::vector<std::string> ret;
+
+	if (js.contains("set")) {
+		for (auto &pair : js["set"].items()) {
+			InternalSetData(pair.key(), pair.value().get<std::string>());
+			if (record) {
+				RecordDataChange(pair.key(), pair.value().get<std::string>(), false);
+			}
+			ret.emplace_back(pair.key());
+		}
+	}
+
+	if (js.contains("remove")) {
+		for (auto &name : js["remove"]) {
+			InternalRemoveData(name.get<std::string>());
+			if (record) {
+				RecordDataChange(name.get<std::string>(), "", true);
+			}
+			ret.emplace_back(name.get<std::string>());
+		}
+	}
+
+	return ret;
+}
@@ -2,6 +2,32 @@
 #include <Unet/LobbyFile.h>
 #include <Unet/xxhash.h>
 
+// fseek and ftell take a long, which is 32 bits on Windows, so they can't handle files of 2 GB and up
+static int FileSeek(FILE* fh, uint64_t offset, int origin)
+{
+#if defined(PLATFORM_WINDOWS)
+	return _fseeki64(fh, (__int64)offset, origin);
+#else
+	return fseeko(fh, (off_t)offset, origin);
+#endif
+}
+
+static uint64_t FileSize(FILE* fh)
+{
+#if defined(PLATFORM_WINDOWS)
+	if (_fseeki64(fh, 0, SEEK_END) != 0) {
+		return 0;
+	}
+	__int64 size = _ftelli64(fh);
+#else
+	if (fseeko(fh, 0, SEEK_END) != 0) {
+		return 0;
+	}
+	off_t size = ftello(fh);
+#endif
+	return (size < 0) ? 0 : (uint64_t)size;
+}
+
 Unet::LobbyFile::LobbyFile(const std::string &filename)
 {
 	m_filename = filename;
@@ -9,22 +35,41 @@ Unet::LobbyFile::LobbyFile(const std::string &filename)
 
 Unet::LobbyFile::~LobbyFile()
 {
-	if (m_buffer != nullptr) {
-		free(m_buffer);
-	}
+	Close();
 }
 
-void Unet::LobbyFile::Prepare(size_t size, uint64_t hash)
+void Unet::LobbyFile::Close()
 {
 	if (m_buffer != nullptr) {
 		free(m_buffer);
+		m_buffer = nullptr;
 	}
 
-	m_buffer = (uint8_t*)malloc(size);
+	if (m_handle != nullptr) {
+		fclose(m_handle);
+		m_handle = nullptr;
+	}
+
+	m_path.clear();
+	m_partial = false;
+	m_verified = false;
+}
+
+void Unet::LobbyFile::Prepare(size_t size, uint64_t hash, const std::vector<uint64_t> &chunkHashes)
+{
+	Close();
+
 	m_size = size;
 	m_availableSize = 0;
 
 	m_hash = hash;
+	m_chunkHashes = chunkHashes;
+	m_chunksAvailable.assign(GetChunkCount(), false);
+
+	// A manifest that doesn't match the file size is useless, so we only check the entire file instead
+	if (m_chunkHashes.size() != m_chunksAvailable.size()) {
+		m_chunkHashes.clear();
+	}
 }
 
 std::string Unet::LobbyFile::GetCachePath() const
@@ -44,20 +89,69 @@ void Unet::LobbyFile::LoadFromCache()
 	if (fh == nullptr) {
 		return;
 	}
-	fclose(fh);
 
-	LoadFromFile(path);
+	uint64_t size = FileSize(fh);
+	if (size != m_size) {
+		fclose(fh);
+		return;
+	}
+
+	// The hash is not recomputed here, IsValid will compare it against the hash we were told about
+	Close();
+
+	m_path = path;
+	m_handle = fh;
+	m_availableSize = m_size;
+	m_chunksAvailable.assign(GetChunkCount(), true);
 }
 
-void Unet::LobbyFile::LoadFromFile(const std::string &filenameOnDisk)
+bool Unet::LobbyFile::LoadPartialFromCache()
 {
-	//TODO: Don't keep buffer in memory and just read from file when needed
+	// Without a manifest we can't tell which chunks of the partial file are good
+	if (m_partial || m_availableSize > 0 || m_chunkHashes.empty()) {
+		return false;
+	}
 
-	if (m_buffer != nullptr) {
-		free(m_buffer);
-		m_buffer = nullptr;
+	std::string path = GetCachePath() + ".part";
+
+	FILE* fh = fopen(path.c_str(), "rb+");
+	if (fh == nullptr) {
+		return false;
 	}
 
+	uint64_t size = FileSize(fh);
+	if (size != m_size) {
+		fclose(fh);
+		return false;
+	}
+
+	Close();
+
+	m_path = path;
+	m_handle = fh;
+	m_partial = true;
+
+	std::vector<uint8_t> chunk(ChunkSize);
+	for (size_t i = 0; i < m_chunksAvailable.size(); i++) {
+		size_t chunkSize = GetChunkSize(i);
+
+		if (FileSeek(m_handle, (uint64_t)i * ChunkSize, SEEK_SET) != 0 || fread(chunk.data(), 1, chunkSize, m_handle) != chunkSize) {
+			break;
+		}
+
+		if (VerifyChunk(i, chunk.data(), chunkSize)) {
+			m_chunksAvailable[i] = true;
+			m_availableSize += chunkSize;
+		}
+	}
+
+	return true;
+}
+
+void Unet::LobbyFile::LoadFromFile(const std::string &filenameOnDisk)
+{
+	Close();
+
 	FILE* fh = fopen(filenameOnDisk.c_str(), "rb");
 	if (fh == nullptr) {
 		// File does not exist!
@@ -65,41 +159,155 @@ void Unet::LobbyFile::LoadFromFile(const std::string &filenameOnDisk)
 		return;
 	}
 
-	fseek(fh, 0, SEEK_END);
-	m_size = ftell(fh);
+	m_size = (size_t)FileSize(fh);
 	m_availableSize = m_size;
-	m_buffer = (uint8_t*)malloc(m_size);
-	fseek(fh, 0, SEEK_SET);
+	m_chunksAvailable.assign(GetChunkCount(), true);
 
-	fread(m_buffer, 1, m_size, fh);
-	fclose(fh);
+	m_path = filenameOnDisk;
+	m_handle = fh;
 
-	m_hash = XXH64(m_buffer, m_size, 0);
+	m_hash = ComputeHash(&m_chunkHashes);
+	m_verified = true;
 }
 
 void Unet::LobbyFile::Load(uint8_t* buffer, size_t size)
 {
-	if (m_buffer != nullptr) {
-		free(m_buffer);
-	}
+	Close();
 
 	m_size = size;
 	m_availableSize = size;
+	m_chunksAvailable.assign(GetChunkCount(), true);
 	m_buffer = (uint8_t*)malloc(size);
 	memcpy(m_buffer, buffer, size);
 
-	m_hash = XXH64(m_buffer, m_size, 0);
+	m_hash = ComputeHash(&m_chunkHashes);
+	m_verified = true;
 }
 
-void Unet::LobbyFile::AppendData(uint8_t* buffer, size_t size)
+size_t Unet::LobbyFile::ReadData(size_t offset, uint8_t* buffer, size_t size) const
 {
-	assert(m_availableSize + size <= m_size);
+	if (offset >= m_size) {
+		return 0;
+	}
+	size = std::min(size, m_size - offset);
+
+	if (m_buffer != nullptr) {
+		memcpy(buffer, m_buffer + offset, size);
+		return size;
+	}
+
+	if (m_handle == nullptr) {
+		return 0;
+	}
 
-	memcpy(m_buffer + m_availableSize, buffer, size);
+	if (FileSeek(m_handle, (uint64_t)offset, SEEK_SET) != 0) {
+		return 0;
+	}
+	return fread(buffer, 1, size, m_handle);
+}
+
+size_t Unet::LobbyFile::GetChunkCount() const
+{
+	return (m_size + ChunkSize - 1) / ChunkSize;
+}
+
+size_t Unet::LobbyFile::GetChunkSize(size_t index) const
+{
+	size_t offset = index * ChunkSize;
+	if (offset >= m_size) {
+		return 0;
+	}
+	return (m_size - offset < ChunkSize) ? (m_size - offset) : ChunkSize;
+}
+
+bool Unet::LobbyFile::HasChunk(size_t index) const
+{
+	return index < m_chunksAvailable.size() && m_chunksAvailable[index];
+}
+
+std::vector<uint8_t> Unet::LobbyFile::GetChunkBitmap() const
+{
+	std::vector<uint8_t> ret((m_chunksAvailable.size() + 7) / 8);
+	for (size_t i = 0; i < m_chunksAvailable.size(); i++) {
+		if (m_chunksAvailable[i]) {
+			ret[i / 8] |= (1 << (i % 8));
+		}
+	}
+	return ret;
+}
+
+bool Unet::LobbyFile::VerifyChunk(size_t index, const uint8_t* buffer, size_t size) const
+{
+	if (index >= m_chunksAvailable.size() || size != GetChunkSize(index)) {
+		return false;
+	}
+
+	if (m_chunkHashes.empty()) {
+		return true;
+	}
+
+	return XXH64(buffer, size, 0) == m_chunkHashes[index];
+}
+
+bool Unet::LobbyFile::OpenPartial()
+{
+	if (!System::FolderExists("UnetCache")) {
+		System::FolderCreate("UnetCache");
+	}
+
+	std::string path = GetCachePath() + ".part";
+
+	FILE* fh = fopen(path.c_str(), "wb+");
+	if (fh == nullptr) {
+		return false;
+	}
+
+	// Allocate the full size up front, so running out of disk space fails early instead of halfway through
+	if (m_size > 0 && (FileSeek(fh, (uint64_t)m_size - 1, SEEK_SET) != 0 || fputc(0, fh) == EOF)) {
+		fclose(fh);
+		remove(path.c_str());
+		return false;
+	}
+
+	m_path = path;
+	m_handle = fh;
+	m_partial = true;
+	return true;
+}
+
+bool Unet::LobbyFile::WriteChunk(size_t index, const uint8_t* buffer, size_t size)
+{
+	assert(index < m_chunksAvailable.size() && size == GetChunkSize(index));
+	if (index >= m_chunksAvailable.size() || size != GetChunkSize(index)) {
+		return false;
+	}
+
+	if (m_chunksAvailable[index]) {
+		return true;
+	}
+
+	if (!m_partial) {
+		assert(m_availableSize == 0);
+		if (m_availableSize != 0 || !OpenPartial()) {
+			return false;
+		}
+	}
+
+	if (FileSeek(m_handle, (uint64_t)index * ChunkSize, SEEK_SET) != 0) {
+		return false;
+	}
+
+	if (fwrite(buffer, 1, size, m_handle) != size) {
+		return false;
+	}
+
+	m_chunksAvailable[index] = true;
 	m_availableSize += size;
+	m_verified = false;
+	return true;
 }
 
-void Unet::LobbyFile::SaveToCache() const
+void Unet::LobbyFile::SaveToCache()
 {
 	assert(IsValid());
 
@@ -108,18 +316,73 @@ void Unet::LobbyFile::SaveToCache() const
 	}
 
 	std::string path = GetCachePath();
+	if (path == m_path) {
+		return;
+	}
+
+	if (m_partial) {
+		// The data is already on disk, so we only have to move it into place
+		fclose(m_handle);
+		m_handle = nullptr;
+
+		remove(path.c_str());
+		if (rename(m_path.c_str(), path.c_str()) != 0) {
+			m_handle = fopen(m_path.c_str(), "rb");
+			return;
+		}
+
+		m_path = path;
+		m_handle = fopen(m_path.c_str(), "rb");
+		m_partial = false;
+		return;
+	}
 
 	FILE* fh = fopen(path.c_str(), "wb");
 	if (fh == nullptr) {
 		return;
 	}
-	fwrite(m_buffer, 1, m_size, fh);
+
+	std::vector<uint8_t> chunk(ChunkSize);
+	for (size_t offset = 0; offset < m_size; offset += ChunkSize) {
+		size_t chunkSize = ReadData(offset, chunk.data(), ChunkSize);
+		if (chunkSize == 0 || fwrite(chunk.data(), 1, chunkSize, fh) != chunkSize) {
+			break;
+		}
+	}
 	fclose(fh);
 }
 
+uint64_t Unet::LobbyFile::ComputeHash(std::vector<uint64_t>* chunkHashes) const
+{
+	if (chunkHashes != nullptr) {
+		chunkHashes->clear();
+	}
+
+	XXH64_state_t* state = XXH64_createState();
+	XXH64_reset(state, 0);
+
+	// Files on disk are read one chunk at a time, so they never have to be held in memory entirely
+	std::vector<uint8_t> chunk(ChunkSize);
+	for (size_t offset = 0; offset < m_size; offset += ChunkSize) {
+		size_t chunkSize = ReadData(offset, chunk.data(), ChunkSize);
+		if (chunkSize == 0) {
+			break;
+		}
+
+		XXH64_update(state, chunk.data(), chunkSize);
+		if (chunkHashes != nullptr) {
+			chunkHashes->emplace_back(XXH64(chunk.data(), chunkSize, 0));
+		}
+	}
+
+	uint64_t hash = XXH64_digest(state);
+	XXH64_freeState(state);
+	return hash;
+}
+
 bool Unet::LobbyFile::IsValid() const
 {
-	if (m_buffer == nullptr) {
+	if (m_buffer == nullptr && m_handle == nullptr) {
 		return false;
 	}
 
@@ -127,11 +390,16 @@ bool Unet::LobbyFile::IsValid() const
 		return false;
 	}
 
-	uint64_t hash = XXH64(m_buffer, m_size, 0);
+	if (m_verified) {
+		return true;
+	}
+
+	uint64_t hash = ComputeHash();
 	if (hash != m_hash) {
 		return false;
 	}
 
+	m_verified = true;
 	return true;
 }
 
@@ -82,6 +82,7 @@ json Unet::LobbyMember::Serialize() const
 		jsFile["filename"] = file->m_filename;
 		jsFile["size"] = file->m_size;
 		jsFile["hash"] = file->m_hash;
+		jsFile["chunks"] = file->m_chunkHashes;
 		js["files"].emplace_back(jsFile);
 	}
 	return js;
@@ -101,7 +102,8 @@ void Unet::LobbyMember::Deserialize(const json &js)
 		auto newFile = new LobbyFile(jsFile["filename"].get<std::string>());
 		size_t size = jsFile["size"].get<size_t>();
 		uint64_t hash = jsFile["hash"].get<uint64_t>();
-		newFile->Prepare(size, hash);
+		auto chunks = jsFile.value("chunks", std::vector<uint64_t>());
+		newFile->Prepare(size, hash, chunks);
 		newFile->LoadFromCache();
 		Files.emplace_back(newFile);
 	}
@@ -113,7 +115,19 @@ void Unet::LobbyMember::SetData(const std::string &name, const std::string &valu
 
 	auto currentLobby = m_ctx->CurrentLobby();
 	assert(currentLobby != nullptr);
-	if (currentLobby != nullptr && currentLobby->GetInfo().IsHosting) {
+	bool isHosting = (currentLobby != nullptr && currentLobby->GetInfo().IsHosting);
+
+	if (m_batchData && (isHosting || UnetPeer == m_ctx->m_localPeer)) {
+		RecordDataChange(name, value, false);
+		if (isHosting) {
+			m_ctx->GetCallbacks()->OnLobbyMemberDataChanged(this, name);
+		}
+		return;
+	}
+
+	m_pendingChanges.erase(name);
+
+	if (isHosting) {
 		json js;
 		js["t"] = (uint8_t)LobbyPacketType::LobbyMemberData;
 		js["guid"] = UnetGuid.str();
@@ -138,7 +152,19 @@ void Unet::LobbyMember::RemoveData(const std::string &name)
 
 	auto currentLobby = m_ctx->CurrentLobby();
 	assert(currentLobby != nullptr);
-	if (currentLobby != nullptr && currentLobby->GetInfo().IsHosting) {
+	bool isHosting = (currentLobby != nullptr && currentLobby->GetInfo().IsHosting);
+
+	if (m_batchData && (isHosting || UnetPeer == m_ctx->m_localPeer)) {
+		RecordDataChange(name, "", true);
+		if (isHosting) {
+			m_ctx->GetCallbacks()->OnLobbyMemberDataChanged(this, name);
+		}
+		return;
+	}
+
+	m_pendingChanges.erase(name);
+
+	if (isHosting) {
 		json js;
 		js["t"] = (uint8_t)LobbyPacketType::LobbyMemberDataRemoved;
 		js["guid"] = UnetGuid.str();
@@ -202,6 +228,7 @@ void Unet::LobbyMember::AddFile(LobbyFile* file)
 		js["filename"] = file->m_filename;
 		js["size"] = file->m_size;
 		js["hash"] = file->m_hash;
+		js["chunks"] = file->m_chunkHashes;
 
 		if (currentLobby->GetInfo().IsHosting) {
 			js["guid"] = UnetGuid.str();
@@ -0,0 +1,138 @@
+#include <Unet_common.h>
+#include <Unet/MessagePool.h>
+#include <Unet/NetworkMessage.h>
+
+Unet::MessagePool::MessagePool()
+{
+}
+
+Unet::MessagePool::~MessagePool()
+{
+	assert(m_stats.MessagesInUse == 0); // All messages must be released before the pool is destroyed
+	Clear();
+}
+
+Unet::NetworkMessage* Unet::MessagePool::AllocMessage(size_t size, size_t capacity)
+{
+	return new (AllocHeader()) NetworkMessage(this, size, std::max(size, capacity));
+}
+
+Unet::NetworkMessage* Unet::MessagePool::AllocMessage(const uint8_t* data, size_t size)
+{
+	auto ret = AllocMessage(size);
+	if (ret->m_data != nullptr) {
+		memcpy(ret->m_data, data, size);
+	}
+	return ret;
+}
+
+Unet::NetworkMessage* Unet::MessagePool::AllocBorrowedMessage(uint8_t* data, size_t size, void (*release)(void*), void* handle)
+{
+	return new (AllocHeader()) NetworkMessage(this, data, size, release, handle);
+}
+
+void Unet::MessagePool::FreeMessage(NetworkMessage* msg)
+{
+	assert(msg->m_pool == this);
+	assert(m_stats.MessagesInUse > 0);
+
+	msg->~NetworkMessage();
+	m_stats.MessagesInUse--;
+
+	if (m_freeMessages.size() >= m_maxCachedMessages) {
+		::operator delete(msg);
+		return;
+	}
+
+	m_freeMessages.emplace_back(msg);
+}
+
+uint8_t* Unet::MessagePool::AllocBlock(size_t size, size_t* outCapacity)
+{
+	int sizeClass = GetSizeClass(size);
+	if (sizeClass == -1) {
+		*outCapacity = size;
+		m_stats.BlockAllocs++;
+		return (uint8_t*)malloc(size);
+	}
+
+	size_t capacity = (size_t)1 << (sizeClass + MinClassShift);
+	*outCapacity = capacity;
+
+	auto &freeBlocks = m_freeBlocks[sizeClass];
+	if (freeBlocks.size() > 0) {
+		uint8_t* ret = freeBlocks.back();
+		freeBlocks.pop_back();
+		m_cachedBytes -= capacity;
+		m_stats.BlockReuses++;
+		return ret;
+	}
+
+	m_stats.BlockAllocs++;
+	return (uint8_t*)malloc(capacity);
+}
+
+void Unet::MessagePool::FreeBlock(uint8_t* block, size_t capacity)
+{
+	if (block == nullptr) {
+		return;
+	}
+
+	int sizeClass = GetSizeClass(capacity);
+	if (sizeClass == -1 || ((size_t)1 << (sizeClass + MinClassShift)) != capacity || m_cachedBytes + capacity > m_maxCachedBytes) {
+		free(block);
+		return;
+	}
+
+	m_freeBlocks[sizeClass].emplace_back(block);
+	m_cachedBytes += capacity;
+}
+
+const Unet::MessagePoolStats &Unet::MessagePool::GetStats() const
+{
+	return m_stats;
+}
+
+void Unet::MessagePool::Clear()
+{
+	for (auto &freeBlocks : m_freeBlocks) {
+		for (auto block : freeBlocks) {
+			free(block);
+		}
+		freeBlocks.clear();
+	}
+	m_cachedBytes = 0;
+
+	for (auto msg : m_freeMessages) {
+		::operator delete(msg);
+	}
+	m_freeMessages.clear();
+}
+
+void* Unet::MessagePool::AllocHeader()
+{
+	void* mem;
+	if (m_freeMessages.size() > 0) {
+		mem = m_freeMessages.back();
+		m_freeMessages.pop_back();
+		m_stats.MessageReuses++;
+	} else {
+		mem = ::operator new(sizeof(NetworkMessage));
+		m_stats.MessageAllocs++;
+	}
+
+	m_stats.MessagesInUse++;
+	return mem;
+}
+
+int Unet::MessagePool::GetSizeClass(size_t size)
+{
+	int sizeClass = 0;
+	while (((size_t)1 << (sizeClass + MinClassShift)) < size) {
+		sizeClass++;
+		if (sizeClass >= NumClasses) {
+			return -1;
+		}
+	}
+	return sizeClass;
+}
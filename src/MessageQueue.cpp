@@ -0,0 +1,94 @@
+#include <Unet_common.h>
+#include <Unet/MessageQueue.h>
+
+void Unet::MessageQueue::SetPolicy(QueuePolicy policy, size_t maxMessages)
+{
+	m_policy = policy;
+	m_maxMessages = maxMessages;
+
+	if (m_policy == QueuePolicy::DropOldest) {
+		while (m_maxMessages > 0 && m_messages.size() > m_maxMessages) {
+			m_messages.front()->Release();
+			m_messages.pop_front();
+			m_dropped++;
+		}
+
+	} else if (m_policy == QueuePolicy::LatestPerPeer) {
+		// Push only replaces a single message per peer, so the backlog has to be brought down to one per peer here
+		std::unordered_set<ServiceID> seenPeers;
+		std::deque<NetworkMessage*> newest;
+		for (auto it = m_messages.rbegin(); it != m_messages.rend(); ++it) {
+			if (seenPeers.insert((*it)->m_peer).second) {
+				newest.push_front(*it);
+			} else {
+				(*it)->Release();
+				m_dropped++;
+			}
+		}
+		m_messages.swap(newest);
+	}
+}
+
+Unet::QueuePolicy Unet::MessageQueue::GetPolicy() const
+{
+	return m_policy;
+}
+
+void Unet::MessageQueue::Push(NetworkMessage* msg)
+{
+	switch (m_policy) {
+	case QueuePolicy::Fifo:
+		break;
+
+	case QueuePolicy::DropOldest:
+		if (m_maxMessages > 0 && m_messages.size() >= m_maxMessages) {
+			m_messages.front()->Release();
+			m_messages.pop_front();
+			m_dropped++;
+		}
+		break;
+
+	case QueuePolicy::LatestPerPeer:
+		// There's at most one message per peer in the queue, so this is linear in the amount of peers
+		for (auto it = m_messages.begin(); it != m_messages.end(); ++it) {
+			if ((*it)->m_peer == msg->m_peer) {
+				(*it)->Release();
+				m_messages.erase(it);
+				m_dropped++;
+				break;
+			}
+		}
+		break;
+	}
+
+	m_messages.push_back(msg);
+}
+
+Unet::NetworkMessage* Unet::MessageQueue::Pop()
+{
+	if (m_messages.size() == 0) {
+		return nullptr;
+	}
+
+	auto ret = m_messages.front();
+	m_messages.pop_front();
+	return ret;
+}
+
+size_t Unet::MessageQueue::Size() const
+{
+	return m_messages.size();
+}
+
+size_t Unet::MessageQueue::GetDropped() const
+{
+	return m_dropped;
+}
+
+void Unet::MessageQueue::Clear()
+{
+	for (auto msg : m_messages) {
+		msg->Release();
+	}
+	m_messages.clear();
+}
@@ -4,6 +4,7 @@
 Unet::NetworkMessage::NetworkMessage(size_t size)
 {
 	m_size = size;
+	m_capacity = size;
 	m_data = (uint8_t*)malloc(size);
 }
 
@@ -15,22 +16,106 @@ Unet::NetworkMessage::NetworkMessage(uint8_t* data, size_t size)
 	}
 }
 
+Unet::NetworkMessage::NetworkMessage(MessagePool* pool, size_t size, size_t capacity)
+{
+	assert(size <= capacity);
+
+	m_pool = pool;
+	m_size = size;
+	m_data = pool->AllocBlock(capacity, &m_capacity);
+}
+
+Unet::NetworkMessage::NetworkMessage(MessagePool* pool, uint8_t* borrowedData, size_t size, BorrowReleaseFunc release, void* handle)
+{
+	m_pool = pool;
+	m_data = borrowedData;
+	m_size = size;
+	m_capacity = size;
+	m_borrowRelease = release;
+	m_borrowHandle = handle;
+}
+
 Unet::NetworkMessage::~NetworkMessage()
 {
-	if (m_data != nullptr) {
-		free(m_data);
-	}
+	FreeData();
+}
+
+bool Unet::NetworkMessage::IsBorrowed() const
+{
+	return m_borrowRelease != nullptr;
 }
 
 void Unet::NetworkMessage::Append(uint8_t* data, size_t size)
 {
-	uint8_t* newData = (uint8_t*)realloc(m_data, m_size + size);
-	assert(newData != nullptr);
-	if (newData == nullptr) {
-		return;
+	if (m_size + size > m_capacity) {
+		size_t newCapacity = m_size + size;
+		uint8_t* newData;
+
+		if (m_pool != nullptr || IsBorrowed()) {
+			// We can't grow borrowed data, so it has to be copied into a buffer that we own first
+			if (m_pool != nullptr) {
+				newData = m_pool->AllocBlock(newCapacity, &newCapacity);
+			} else {
+				newData = (uint8_t*)malloc(newCapacity);
+			}
+
+			assert(newData != nullptr);
+			if (newData == nullptr) {
+				return;
+			}
+
+			memcpy(newData, m_data, m_size);
+			FreeData();
+		} else {
+			newData = (uint8_t*)realloc(m_data, newCapacity);
+
+			assert(newData != nullptr);
+			if (newData == nullptr) {
+				return;
+			}
+		}
+
+		m_data = newData;
+		m_capacity = newCapacity;
 	}
 
-	m_data = newData;
 	memcpy(m_data + m_size, data, size);
 	m_size += size;
 }
+
+void Unet::NetworkMessage::AddRef()
+{
+	m_refCount++;
+}
+
+void Unet::NetworkMessage::Release()
+{
+	assert(m_refCount > 0);
+	if (--m_refCount > 0) {
+		return;
+	}
+
+	if (m_pool != nullptr) {
+		m_pool->FreeMessage(this);
+	} else {
+		delete this;
+	}
+}
+
+void Unet::NetworkMessage::FreeData()
+{
+	if (IsBorrowed()) {
+		m_borrowRelease(m_borrowHandle);
+		m_borrowRelease = nullptr;
+		m_borrowHandle = nullptr;
+
+	} else if (m_data != nullptr) {
+		if (m_pool != nullptr) {
+			m_pool->FreeBlock(m_data, m_capacity);
+		} else {
+			free(m_data);
+		}
+	}
+
+	m_data = nullptr;
+}
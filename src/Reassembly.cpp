@@ -22,8 +22,13 @@ void Unet::Reassembly::HandleMessage(ServiceID peer, int channel, uint8_t* msgDa
 	packetSize--;
 
 	if ((sequenceId & RELIABLE_MASK) == 0) {
+		if (sequenceId != 0) {
+			HandleUnreliableFragment(peer, channel, sequenceId, msgData, packetSize);
+			return;
+		}
+
 		// If this is actually an unreliable packet, just handle it as a single message
-		auto newMessage = new NetworkMessage(msgData, packetSize);
+		auto newMessage = m_ctx->m_messagePool.AllocMessage(msgData, packetSize);
 		newMessage->m_channel = channel;
 		newMessage->m_peer = peer;
 		m_ready.push(newMessage);
@@ -31,26 +36,49 @@ void Unet::Reassembly::HandleMessage(ServiceID peer, int channel, uint8_t* msgDa
 	}
 	sequenceId &= SEQUENCE_MASK;
 
-	auto existingMsg = std::find_if(m_staging.begin(), m_staging.end(), [sequenceId](NetworkMessage * msg) {
-		return msg->m_sequenceId == sequenceId;
-	});
+	auto now = std::chrono::steady_clock::now();
+
+	StagingKey key = { peer, channel, (uint8_t)(sequenceId | RELIABLE_MASK) };
+	auto existing = m_staging.find(key);
+
+	if (existing != m_staging.end()) {
+		auto &entry = existing->second;
+		entry.LastActivity = now;
 
-	if (existingMsg != m_staging.end()) {
-		auto msg = *existingMsg;
-		assert(msg->m_sequenceSize > 0);
+		if (packetSize > entry.Remaining) {
+			m_ctx->GetCallbacks()->OnLogError(strPrintF("Fragment of %d bytes from 0x%016llX overflows its sequence, discarding message", (int)packetSize, peer.ID));
+			RemoveStaging(existing);
+			return;
+		}
+		entry.Remaining -= packetSize;
+
+		auto msg = entry.Message;
+		if (msg != nullptr) {
+			msg->Append(msgData, packetSize);
+		}
 
-		msg->Append(msgData, packetSize);
+		if (entry.Remaining > 0) {
+			return;
+		}
+
+		if (msg != nullptr) {
+			assert(msg->m_size == msg->m_sequenceSize);
 
-		assert(msg->m_size <= msg->m_sequenceSize);
-		if (msg->m_size == msg->m_sequenceSize) {
 			uint32_t finalHash = XXH32(msg->m_data, msg->m_size, 0);
 			if (finalHash != msg->m_sequenceHash) {
 				m_ctx->GetCallbacks()->OnLogError(strPrintF("Sequence hash for fragmented packet does not match! Packet size: %d", (int)msg->m_size));
 			}
 
-			m_staging.erase(existingMsg);
+			entry.Message = nullptr;
 			m_ready.push(msg);
 		}
+
+		RemoveStaging(existing);
+		return;
+	}
+
+	if (packetSize < 4) {
+		m_ctx->GetCallbacks()->OnLogError(strPrintF("Received a truncated fragment of %d bytes from 0x%016llX", (int)packetSize, peer.ID));
 		return;
 	}
 
@@ -60,26 +88,49 @@ void Unet::Reassembly::HandleMessage(ServiceID peer, int channel, uint8_t* msgDa
 
 	if (sequenceSize == packetSize) {
 		// We have the full packet size already, we're not expecting any more packets
-		auto newMessage = new NetworkMessage(msgData, packetSize);
+		auto newMessage = m_ctx->m_messagePool.AllocMessage(msgData, packetSize);
 		newMessage->m_channel = channel;
 		newMessage->m_peer = peer;
 		m_ready.push(newMessage);
 
 	} else {
+		// We're expecting multiple packets, so at this point the sequence size must be bigger than the data we have left
+		if (packetSize < 4 || sequenceSize <= packetSize - 4) {
+			m_ctx->GetCallbacks()->OnLogError(strPrintF("Received an invalid first fragment of %d bytes from 0x%016llX", (int)packetSize, peer.ID));
+			return;
+		}
+
 		uint32_t packetHash = *(uint32_t*)msgData;
 		msgData += 4;
 		packetSize -= 4;
 
-		// We're expecting multiple packets, so at this point the sequence size must be bigger than the data we have left
-		assert(sequenceSize > packetSize);
+		StagingEntry newEntry;
+		newEntry.Remaining = sequenceSize - packetSize;
+		newEntry.LastActivity = now;
 
-		auto newMessage = new NetworkMessage(msgData, packetSize);
-		newMessage->m_sequenceId = sequenceId;
-		newMessage->m_sequenceSize = sequenceSize;
-		newMessage->m_sequenceHash = packetHash;
-		newMessage->m_channel = channel;
-		newMessage->m_peer = peer;
-		m_staging.emplace_back(newMessage);
+		auto &stagingBytes = m_stagingBytes[peer];
+		if (stagingBytes + sequenceSize > m_maxStagingBytesPerPeer) {
+			// Keep the entry without a message, so that the rest of the fragments are swallowed instead of misread
+			m_ctx->GetCallbacks()->OnLogError(strPrintF("Discarding fragmented message of %d bytes from 0x%016llX, peer exceeds the staging limit of %d bytes",
+				(int)sequenceSize, peer.ID, (int)m_maxStagingBytesPerPeer
+			));
+
+		} else {
+			// Allocate the full message once, so the remaining fragments are written in place
+			auto newMessage = m_ctx->m_messagePool.AllocMessage((size_t)0, sequenceSize);
+			newMessage->Append(msgData, packetSize);
+			newMessage->m_sequenceId = sequenceId;
+			newMessage->m_sequenceSize = sequenceSize;
+			newMessage->m_sequenceHash = packetHash;
+			newMessage->m_channel = channel;
+			newMessage->m_peer = peer;
+
+			newEntry.Message = newMessage;
+			newEntry.Reserved = sequenceSize;
+			stagingBytes += sequenceSize;
+		}
+
+		m_staging.emplace(key, newEntry);
 	}
 }
 
@@ -94,35 +145,75 @@ Unet::NetworkMessage* Unet::Reassembly::PopReady()
 	return ret;
 }
 
+void Unet::Reassembly::RunTimeouts()
+{
+	auto now = std::chrono::steady_clock::now();
+	if (now < m_nextTimeoutCheck) {
+		return;
+	}
+	m_nextTimeoutCheck = now + std::chrono::seconds(1);
+
+	for (auto it = m_staging.begin(); it != m_staging.end();) {
+		if (now - it->second.LastActivity < m_stagingTimeout) {
+			++it;
+			continue;
+		}
+
+		m_ctx->GetCallbacks()->OnLogWarn(strPrintF("Fragmented message from 0x%016llX on channel %d timed out with %d bytes missing",
+			it->first.Peer.ID, it->first.Channel, (int)it->second.Remaining
+		));
+		it = RemoveStaging(it);
+	}
+}
+
 void Unet::Reassembly::Clear()
 {
-	for (auto msg : m_staging) {
-		delete msg;
+	for (auto &pair : m_staging) {
+		if (pair.second.Message != nullptr) {
+			pair.second.Message->Release();
+		}
 	}
 	m_staging.clear();
+	m_stagingBytes.clear();
 
 	while (m_ready.size() > 0) {
-		delete m_ready.front();
+		m_ready.front()->Release();
 		m_ready.pop();
 	}
 }
 
+void Unet::Reassembly::ClearPeer(const ServiceID &peer)
+{
+	for (auto it = m_staging.begin(); it != m_staging.end();) {
+		if (it->first.Peer == peer) {
+			it = RemoveStaging(it);
+		} else {
+			++it;
+		}
+	}
+}
+
 void Unet::Reassembly::SplitMessage(uint8_t* data, size_t size, PacketType type, size_t sizeLimit, const std::function<void(uint8_t*, size_t)> &callback)
 {
-	m_sequenceId++;
-	m_sequenceId &= SEQUENCE_MASK;
+	// Subtract 3 to ensure that, in the case of these being relay packets, we can still send them
+	sizeLimit -= 3; //TODO: Do this selectively, only if relay is actually required?
+
+	if (type != PacketType::Reliable) {
+		if (size + 1 > sizeLimit) {
+			SplitUnreliableMessage(data, size, sizeLimit, callback);
+			return;
+		}
 
-	if (type == PacketType::Unreliable) {
+		// Unreliable messages that fit in a single packet have a sequence ID of 0
 		m_tempBuffer.resize(size + 1);
-		m_tempBuffer[0] = m_sequenceId;
-		m_tempBuffer[1] = 0;
+		m_tempBuffer[0] = 0;
 		memcpy(m_tempBuffer.data() + 1, data, size);
 		callback(m_tempBuffer.data(), m_tempBuffer.size());
 		return;
 	}
 
-	// Subtract 3 to ensure that, in the case of these being relay packets, we can still send them
-	sizeLimit -= 3; //TODO: Do this selectively, only if relay is actually required?
+	m_sequenceId++;
+	m_sequenceId &= SEQUENCE_MASK;
 
 	assert(size <= 0xFFFFFFFF); // Size is sent as a 32 bit unsigned integer, so you can't send packets bigger than 4GB
 
@@ -181,3 +272,181 @@ void Unet::Reassembly::SplitMessage(uint8_t* data, size_t size, PacketType type,
 		ptr += dataSize;
 	}
 }
+
+bool Unet::Reassembly::UnpackBatch(NetworkMessage* batch, const std::function<void(NetworkMessage*)> &callback)
+{
+	// Batches are a sequence of messages, each prefixed with its size as a 32 bit unsigned integer
+	uint8_t* p = batch->m_data;
+	size_t bytesLeft = batch->m_size;
+
+	while (bytesLeft > 0) {
+		if (bytesLeft < 4) {
+			return false;
+		}
+
+		uint32_t msgSize;
+		memcpy(&msgSize, p, 4);
+		p += 4;
+		bytesLeft -= 4;
+
+		if (msgSize > bytesLeft) {
+			return false;
+		}
+
+		auto newMessage = m_ctx->m_messagePool.AllocMessage(p, msgSize);
+		newMessage->m_channel = batch->m_channel;
+		newMessage->m_peer = batch->m_peer;
+		callback(newMessage);
+
+		p += msgSize;
+		bytesLeft -= msgSize;
+	}
+
+	return true;
+}
+
+void Unet::Reassembly::SplitUnreliableMessage(uint8_t* data, size_t size, size_t sizeLimit, const std::function<void(uint8_t*, size_t)> &callback)
+{
+	// Sequence ID 0 is used for unreliable messages that aren't fragmented, so these cycle from 1 to 127
+	m_unreliableSequenceId = (m_unreliableSequenceId % SEQUENCE_MASK) + 1;
+
+	assert(size <= 0xFFFFFFFF);
+
+	// Unreliable fragments can arrive in any order, so every fragment has the full size, hash and its own offset
+	const size_t extraData = 1 + 4 + 4 + 4;
+	assert(sizeLimit > extraData);
+
+	uint32_t shortSize = (uint32_t)size;
+	XXH32_hash_t hashData = XXH32(data, size, 0);
+
+	size_t chunkSize = sizeLimit - extraData;
+	for (size_t offset = 0; offset < size; offset += chunkSize) {
+		size_t dataSize = std::min(size - offset, chunkSize);
+		uint32_t shortOffset = (uint32_t)offset;
+
+		m_tempBuffer.resize(dataSize + extraData);
+		m_tempBuffer[0] = m_unreliableSequenceId;
+		memcpy(m_tempBuffer.data() + 1, &shortSize, 4);
+		memcpy(m_tempBuffer.data() + 5, &hashData, 4);
+		memcpy(m_tempBuffer.data() + 9, &shortOffset, 4);
+		memcpy(m_tempBuffer.data() + extraData, data + offset, dataSize);
+
+		callback(m_tempBuffer.data(), m_tempBuffer.size());
+	}
+}
+
+void Unet::Reassembly::HandleUnreliableFragment(ServiceID peer, int channel, uint8_t sequenceId, uint8_t* msgData, size_t packetSize)
+{
+	if (packetSize < 12) {
+		m_ctx->GetCallbacks()->OnLogError(strPrintF("Received a truncated unreliable fragment of %d bytes from 0x%016llX", (int)packetSize, peer.ID));
+		return;
+	}
+
+	uint32_t sequenceSize, sequenceHash, offset;
+	memcpy(&sequenceSize, msgData, 4);
+	memcpy(&sequenceHash, msgData + 4, 4);
+	memcpy(&offset, msgData + 8, 4);
+	msgData += 12;
+	packetSize -= 12;
+
+	StagingKey key = { peer, channel, sequenceId };
+	auto it = m_staging.find(key);
+
+	if (it != m_staging.end() && (it->second.Hash != sequenceHash || it->second.Size != sequenceSize)) {
+		// The message that had this sequence ID before lost a fragment, so it will never be completed
+		RemoveStaging(it);
+		it = m_staging.end();
+	}
+
+	if (it == m_staging.end()) {
+		StagingEntry newEntry;
+		newEntry.Remaining = sequenceSize;
+		newEntry.Hash = sequenceHash;
+		newEntry.Size = sequenceSize;
+
+		auto &stagingBytes = m_stagingBytes[peer];
+		if (stagingBytes + sequenceSize > m_maxStagingBytesPerPeer) {
+			m_ctx->GetCallbacks()->OnLogError(strPrintF("Discarding unreliable fragmented message of %d bytes from 0x%016llX, peer exceeds the staging limit of %d bytes",
+				(int)sequenceSize, peer.ID, (int)m_maxStagingBytesPerPeer
+			));
+
+		} else {
+			auto newMessage = m_ctx->m_messagePool.AllocMessage((size_t)sequenceSize, (size_t)sequenceSize);
+			newMessage->m_sequenceId = sequenceId;
+			newMessage->m_sequenceSize = sequenceSize;
+			newMessage->m_sequenceHash = sequenceHash;
+			newMessage->m_channel = channel;
+			newMessage->m_peer = peer;
+
+			newEntry.Message = newMessage;
+			newEntry.Reserved = sequenceSize;
+			stagingBytes += sequenceSize;
+		}
+
+		it = m_staging.emplace(key, newEntry).first;
+	}
+
+	auto &entry = it->second;
+	entry.LastActivity = std::chrono::steady_clock::now();
+
+	// Checked against the size the entry was staged with, which is what the message buffer was allocated for
+	if (offset > entry.Size || packetSize > entry.Size - offset) {
+		m_ctx->GetCallbacks()->OnLogError(strPrintF("Unreliable fragment of %d bytes from 0x%016llX is out of bounds", (int)packetSize, peer.ID));
+		return;
+	}
+
+	if (!entry.ReceivedOffsets.insert(offset).second) {
+		// Unreliable packets can arrive more than once
+		return;
+	}
+
+	if (packetSize > entry.Remaining) {
+		m_ctx->GetCallbacks()->OnLogError(strPrintF("Unreliable fragment of %d bytes from 0x%016llX overflows its sequence, discarding message", (int)packetSize, peer.ID));
+		RemoveStaging(it);
+		return;
+	}
+	entry.Remaining -= packetSize;
+
+	auto msg = entry.Message;
+	if (msg != nullptr && packetSize > 0) {
+		assert(msg->m_size == entry.Size);
+		memcpy(msg->m_data + offset, msgData, packetSize);
+	}
+
+	if (entry.Remaining > 0) {
+		return;
+	}
+
+	if (msg != nullptr) {
+		uint32_t finalHash = XXH32(msg->m_data, msg->m_size, 0);
+		if (finalHash != msg->m_sequenceHash) {
+			m_ctx->GetCallbacks()->OnLogError(strPrintF("Sequence hash for unreliable fragmented packet does not match, discarding message of %d bytes", (int)msg->m_size));
+		} else {
+			entry.Message = nullptr;
+			m_ready.push(msg);
+		}
+	}
+
+	RemoveStaging(it);
+}
+
+Unet::Reassembly::StagingIterator Unet::Reassembly::RemoveStaging(StagingIterator it)
+{
+	auto &entry = it->second;
+
+	if (entry.Reserved > 0) {
+		auto itBytes = m_stagingBytes.find(it->first.Peer);
+		assert(itBytes != m_stagingBytes.end());
+		if (itBytes != m_stagingBytes.end()) {
+			itBytes->second -= entry.Reserved;
+			if (itBytes->second == 0) {
+				m_stagingBytes.erase(itBytes);
+			}
+		}
+	}
+
+	if (entry.Message != nullptr) {
+		entry.Message->Release();
+	}
+	return m_staging.erase(it);
+}
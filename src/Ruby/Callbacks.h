@@ -132,6 +132,8 @@ public:
             case Unet::LeaveReason::Kicked: reasonStr = "Kicked";
                 break;
         }
+        reset_peer_state();
+
         auto reason = mrb_hash_new_capa(update_state, 1);
         pext_hash_set(update_state, reason, "reason", reasonStr);
         push_to_updates(on_lobby_self_left, reason);
@@ -158,6 +160,8 @@ public:
     }
 
     void OnLobbyPlayerLeft(Unet::LobbyMember* member) override {
+        remove_peer_state(member->UnetPeer);
+
         mrb_value info = mrb_hash_new_capa(update_state, 1);
         pext_hash_set(update_state, info, "name", member->Name);
         push_to_updates(on_lobby_player_left, info);
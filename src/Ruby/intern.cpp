@@ -0,0 +1,403 @@
+#include "intern.h"
+#include <cstring>
+
+#include "api.h"
+#include "komihash.h"
+
+// Encoded values start with the lowest byte of the base table hash, followed by a tagged value. Integers and
+// sizes are LEB128 varints, with signed integers zigzag encoded first. Floats are 64 bit little endian.
+enum InternTag : uint8_t {
+    TAG_NIL = 0,
+    TAG_TRUE,
+    TAG_FALSE,
+    TAG_INT,
+    TAG_FLOAT,
+    // [size] [bytes]
+    TAG_STRING,
+    // [size] [bytes], for symbols that didn't fit in the table anymore
+    TAG_SYMBOL,
+    // [count] [value]...
+    TAG_ARRAY,
+    // [count] ([key] [value])...
+    TAG_HASH,
+    // [id]
+    TAG_KEY,
+    // [id] [is symbol] [size] [bytes]
+    TAG_KEY_DEFINE,
+};
+
+// Guards against cyclic values when encoding, and against blowing the stack on malicious packets when decoding
+constexpr int MAX_DEPTH = 64;
+
+static void write_varint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+static bool read_varint(const uint8_t*& p, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (p == end) {
+            return false;
+        }
+        uint8_t byte = *p++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool read_bytes(const uint8_t*& p, const uint8_t* end, const char*& bytes, size_t& size) {
+    uint64_t value;
+    if (!read_varint(p, end, value) || value > (uint64_t)(end - p)) {
+        return false;
+    }
+    bytes = (const char*)p;
+    size = (size_t)value;
+    p += size;
+    return true;
+}
+
+void InternTable::set(std::vector<InternedKey>&& new_keys) {
+    keys = std::move(new_keys);
+
+    uint64_t seed = 0;
+    for (auto& key : keys) {
+        seed = komihash(key.name.data(), key.name.size(), seed + (key.symbol ? 1 : 0));
+    }
+    hash = (uint8_t)seed;
+}
+
+InternEncoder::InternEncoder(const InternTable& table) {
+    table_hash = table.hash;
+    next_id = 0;
+    for (auto& key : table.keys) {
+        std::string lookup(1, key.symbol ? 1 : 0);
+        lookup += key.name;
+        if (entries.emplace(lookup, Entry { next_id, true }).second) {
+            next_id++;
+        }
+    }
+}
+
+bool InternEncoder::write_key(const char* name, size_t size, bool symbol, std::vector<uint8_t>& out) {
+    std::string lookup(1, symbol ? 1 : 0);
+    lookup.append(name, size);
+
+    auto it = entries.find(lookup);
+    if (it == entries.end()) {
+        if (next_id >= MAX_INTERNED_KEYS) {
+            out.push_back(symbol ? TAG_SYMBOL : TAG_STRING);
+            write_varint(out, size);
+            out.insert(out.end(), name, name + size);
+            return true;
+        }
+        it = entries.emplace(std::move(lookup), Entry { next_id++, false }).first;
+        unacknowledged.emplace(it->second.id, it->first);
+    }
+
+    if (it->second.established) {
+        out.push_back(TAG_KEY);
+        write_varint(out, it->second.id);
+        return true;
+    }
+
+    out.push_back(TAG_KEY_DEFINE);
+    write_varint(out, it->second.id);
+    out.push_back(symbol ? 1 : 0);
+    write_varint(out, size);
+    out.insert(out.end(), name, name + size);
+    return true;
+}
+
+bool InternEncoder::write_value(mrb_state* mrb, mrb_value value, int depth, std::vector<uint8_t>& out) {
+    if (depth > MAX_DEPTH) {
+        return false;
+    }
+
+    switch (mrb_type(value)) {
+        case MRB_TT_FALSE:
+            out.push_back(mrb_nil_p(value) ? TAG_NIL : TAG_FALSE);
+            return true;
+
+        case MRB_TT_TRUE:
+            out.push_back(TAG_TRUE);
+            return true;
+
+        case MRB_TT_INTEGER: {
+            int64_t integer = (int64_t)mrb_integer(value);
+            out.push_back(TAG_INT);
+            write_varint(out, ((uint64_t)integer << 1) ^ (uint64_t)(integer >> 63));
+            return true;
+        }
+
+        case MRB_TT_FLOAT: {
+            double number = (double)mrb_float(value);
+            uint64_t bits;
+            memcpy(&bits, &number, 8);
+            out.push_back(TAG_FLOAT);
+            for (int i = 0; i < 8; i++) {
+                out.push_back((uint8_t)(bits >> (i * 8)));
+            }
+            return true;
+        }
+
+        case MRB_TT_STRING:
+            out.push_back(TAG_STRING);
+            write_varint(out, RSTRING_LEN(value));
+            out.insert(out.end(), RSTRING_PTR(value), RSTRING_PTR(value) + RSTRING_LEN(value));
+            return true;
+
+        case MRB_TT_SYMBOL: {
+            mrb_int size;
+            auto name = mrb_sym_name_len(mrb, mrb_symbol(value), &size);
+            return write_key(name, (size_t)size, true, out);
+        }
+
+        case MRB_TT_ARRAY: {
+            auto count = RARRAY_LEN(value);
+            out.push_back(TAG_ARRAY);
+            write_varint(out, count);
+            for (mrb_int i = 0; i < count; i++) {
+                if (!write_value(mrb, RARRAY_PTR(value)[i], depth + 1, out)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        case MRB_TT_HASH: {
+            auto keys = mrb_hash_keys(mrb, value);
+            auto count = RARRAY_LEN(keys);
+            out.push_back(TAG_HASH);
+            write_varint(out, count);
+            for (mrb_int i = 0; i < count; i++) {
+                auto key = RARRAY_PTR(keys)[i];
+                bool written;
+                if (mrb_type(key) == MRB_TT_STRING) {
+                    written = write_key(RSTRING_PTR(key), RSTRING_LEN(key), false, out);
+                } else {
+                    written = write_value(mrb, key, depth + 1, out);
+                }
+                if (!written || !write_value(mrb, mrb_hash_get(mrb, value, key), depth + 1, out)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        default:
+            return false;
+    }
+}
+
+bool InternEncoder::encode(mrb_state* mrb, mrb_value value, std::vector<uint8_t>& out) {
+    out.clear();
+    out.push_back(table_hash);
+    return write_value(mrb, value, 0, out);
+}
+
+bool InternEncoder::acknowledge(const uint8_t* data, size_t size) {
+    const uint8_t* p = data;
+    const uint8_t* end = data + size;
+    while (p != end) {
+        uint64_t id;
+        if (!read_varint(p, end, id)) {
+            return false;
+        }
+
+        // Acknowledgements can be duplicated, or arrive after the key was already acknowledged
+        auto it = unacknowledged.find((uint32_t)id);
+        if (it == unacknowledged.end()) {
+            continue;
+        }
+        entries[it->second].established = true;
+        unacknowledged.erase(it);
+    }
+    return true;
+}
+
+InternDecoder::InternDecoder(mrb_state* mrb, const InternTable& table) {
+    table_hash = table.hash;
+    entries.reserve(table.keys.size());
+    for (auto& key : table.keys) {
+        Entry entry;
+        entry.defined = true;
+        entry.symbol = key.symbol;
+        if (key.symbol) {
+            entry.sym = mrb_intern(mrb, key.name.data(), key.name.size());
+        } else {
+            entry.name = key.name;
+        }
+        entries.push_back(std::move(entry));
+    }
+}
+
+bool InternDecoder::read_key(mrb_state* mrb, const uint8_t*& p, const uint8_t* end, bool define, mrb_value& out) {
+    uint64_t id;
+    if (!read_varint(p, end, id) || id >= MAX_INTERNED_KEYS) {
+        return false;
+    }
+
+    if (define) {
+        if (p == end) {
+            return false;
+        }
+        bool symbol = *p++ != 0;
+        const char* name;
+        size_t size;
+        if (!read_bytes(p, end, name, size)) {
+            return false;
+        }
+
+        if (id >= entries.size()) {
+            entries.resize(id + 1);
+        }
+        auto& entry = entries[id];
+        entry.defined = true;
+        entry.symbol = symbol;
+        defined.push_back((uint32_t)id);
+        if (symbol) {
+            entry.sym = mrb_intern(mrb, name, size);
+            entry.name.clear();
+        } else {
+            entry.name.assign(name, size);
+        }
+    }
+
+    if (id >= entries.size() || !entries[id].defined) {
+        return false;
+    }
+
+    auto& entry = entries[id];
+    if (entry.symbol) {
+        out = mrb_symbol_value(entry.sym);
+    } else {
+        out = mrb_str_new(mrb, entry.name.data(), entry.name.size());
+    }
+    return true;
+}
+
+bool InternDecoder::read_value(mrb_state* mrb, const uint8_t*& p, const uint8_t* end, int depth, mrb_value& out) {
+    if (depth > MAX_DEPTH || p == end) {
+        return false;
+    }
+
+    switch (*p++) {
+        case TAG_NIL:
+            out = mrb_nil_value();
+            return true;
+
+        case TAG_TRUE:
+            out = mrb_true_value();
+            return true;
+
+        case TAG_FALSE:
+            out = mrb_false_value();
+            return true;
+
+        case TAG_INT: {
+            uint64_t value;
+            if (!read_varint(p, end, value)) {
+                return false;
+            }
+            out = mrb_int_value(mrb, (mrb_int)((int64_t)(value >> 1) ^ -(int64_t)(value & 1)));
+            return true;
+        }
+
+        case TAG_FLOAT: {
+            if (end - p < 8) {
+                return false;
+            }
+            uint64_t bits = 0;
+            for (int i = 0; i < 8; i++) {
+                bits |= (uint64_t)p[i] << (i * 8);
+            }
+            p += 8;
+            double number;
+            memcpy(&number, &bits, 8);
+            out = mrb_float_value(mrb, (mrb_float)number);
+            return true;
+        }
+
+        case TAG_STRING:
+        case TAG_SYMBOL: {
+            bool symbol = p[-1] == TAG_SYMBOL;
+            const char* bytes;
+            size_t size;
+            if (!read_bytes(p, end, bytes, size)) {
+                return false;
+            }
+            out = symbol ? mrb_symbol_value(mrb_intern(mrb, bytes, size)) : mrb_str_new(mrb, bytes, size);
+            return true;
+        }
+
+        case TAG_ARRAY: {
+            uint64_t count;
+            // Every element takes at least one byte
+            if (!read_varint(p, end, count) || count > (uint64_t)(end - p)) {
+                return false;
+            }
+            out = mrb_ary_new_capa(mrb, (mrb_int)count);
+            for (uint64_t i = 0; i < count; i++) {
+                mrb_value element;
+                if (!read_value(mrb, p, end, depth + 1, element)) {
+                    return false;
+                }
+                mrb_ary_push(mrb, out, element);
+            }
+            return true;
+        }
+
+        case TAG_HASH: {
+            uint64_t count;
+            if (!read_varint(p, end, count) || count > (uint64_t)(end - p) / 2) {
+                return false;
+            }
+            out = mrb_hash_new_capa(mrb, (mrb_int)count);
+            for (uint64_t i = 0; i < count; i++) {
+                mrb_value key, value;
+                if (!read_value(mrb, p, end, depth + 1, key) || !read_value(mrb, p, end, depth + 1, value)) {
+                    return false;
+                }
+                mrb_hash_set(mrb, out, key, value);
+            }
+            return true;
+        }
+
+        case TAG_KEY:
+            return read_key(mrb, p, end, false, out);
+
+        case TAG_KEY_DEFINE:
+            return read_key(mrb, p, end, true, out);
+
+        default:
+            return false;
+    }
+}
+
+bool InternDecoder::decode(mrb_state* mrb, const uint8_t* data, size_t size, mrb_value& out) {
+    if (size < 1 || data[0] != table_hash) {
+        return false;
+    }
+
+    const uint8_t* p = data + 1;
+    const uint8_t* end = data + size;
+    defined.clear();
+    return read_value(mrb, p, end, 0, out) && p == end;
+}
+
+bool InternDecoder::write_acknowledgement(std::vector<uint8_t>& out) const {
+    if (defined.empty()) {
+        return false;
+    }
+    for (auto id : defined) {
+        write_varint(out, id);
+    }
+    return true;
+}
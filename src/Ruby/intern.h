@@ -0,0 +1,85 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <dragonruby.h>
+
+// Connections stop interning new keys past this amount, and send them inline instead
+constexpr uint32_t MAX_INTERNED_KEYS = 4096;
+
+// A hash key or symbol that can be replaced by a short ID
+struct InternedKey {
+    std::string name;
+    bool symbol;
+};
+
+// The keys every connection starts out with. Both sides have to use the same base table, which is checked with
+// the lowest byte of its hash.
+struct InternTable {
+    std::vector<InternedKey> keys;
+    uint8_t hash = 0;
+
+    void set(std::vector<InternedKey>&& new_keys);
+};
+
+// Serializes values for a single connection. Keys that aren't in the table yet are sent inline along with the
+// ID they get, and are only referenced by their ID once the receiver acknowledged them. Until then, every packet
+// using them carries the definition, so packets can be lost or arrive out of order.
+class InternEncoder {
+private:
+    struct Entry {
+        uint32_t id;
+        bool established;
+    };
+
+    uint8_t table_hash;
+    uint32_t next_id;
+    std::unordered_map<std::string, Entry> entries;
+    // Keys that were sent inline but not acknowledged yet, by ID
+    std::unordered_map<uint32_t, std::string> unacknowledged;
+
+    bool write_key(const char* name, size_t size, bool symbol, std::vector<uint8_t>& out);
+    bool write_value(mrb_state* mrb, mrb_value value, int depth, std::vector<uint8_t>& out);
+
+public:
+    explicit InternEncoder(const InternTable& table);
+
+    // Returns false if the value contains something that can't be encoded this way, in which case it has to be
+    // sent with OSSP instead.
+    bool encode(mrb_state* mrb, mrb_value value, std::vector<uint8_t>& out);
+
+    // Handles an acknowledgement written by InternDecoder::write_acknowledgement. Returns false if it's malformed.
+    bool acknowledge(const uint8_t* data, size_t size);
+};
+
+// Deserializes values received from a single connection. Symbols are interned into the mruby state once, when
+// their key is defined, so decoding them doesn't allocate.
+class InternDecoder {
+private:
+    struct Entry {
+        bool defined = false;
+        bool symbol = false;
+        mrb_sym sym = 0;
+        std::string name;
+    };
+
+    uint8_t table_hash;
+    std::vector<Entry> entries;
+    // IDs of the keys defined by the last decoded payload
+    std::vector<uint32_t> defined;
+
+    bool read_key(mrb_state* mrb, const uint8_t*& p, const uint8_t* end, bool define, mrb_value& out);
+    bool read_value(mrb_state* mrb, const uint8_t*& p, const uint8_t* end, int depth, mrb_value& out);
+
+public:
+    InternDecoder(mrb_state* mrb, const InternTable& table);
+
+    // Returns false if the data is malformed, references an unknown key or was encoded with another base table
+    bool decode(mrb_state* mrb, const uint8_t* data, size_t size, mrb_value& out);
+
+    // Writes the IDs of the keys defined by the last decoded payload, which the sender needs before it can stop
+    // sending them inline. Returns false if there aren't any.
+    bool write_acknowledgement(std::vector<uint8_t>& out) const;
+};
@@ -22,6 +22,8 @@
 #include "symbols.h"
 #include "utility.h"
 #include "print.h"
+#include "snapshot.h"
+#include "intern.h"
 
 using namespace lyniat::ossp::serialize::bin;
 using namespace lyniat::memory::buffer;
@@ -56,7 +58,79 @@ static bool g_galaxyEnabled = false;
 static bool g_enetEnabled = false;
 std::string lobby_to_join;
 
+// Every payload starts with one of these flags, telling the receiver whether it has to be uncompressed
+enum PayloadFlag : uint8_t {
+    PAYLOAD_RAW = 0,
+    PAYLOAD_COMPRESSED = 1,
+    // Followed by the lowest byte of the dictionary hash, to catch peers using a different dictionary
+    PAYLOAD_DICTIONARY = 2,
+
+    // Set on top of the compression mode for snapshot deltas and their acknowledgements
+    PAYLOAD_SNAPSHOT = 0x80,
+    PAYLOAD_SNAPSHOT_ACK = 0x40,
+    // Set on top of the compression mode for values encoded with the key interning table of the connection, and
+    // for acknowledgements of the keys those defined
+    PAYLOAD_INTERNED = 0x20,
+    PAYLOAD_INTERNED_ACK = 0x10,
+    PAYLOAD_MODE_MASK = 0x0F,
+};
+
+// Payloads smaller than min_size are sent uncompressed, as compressing them is likely to make them bigger.
+// Payloads that don't get smaller after compressing are sent uncompressed as well.
+struct CompressionPolicy {
+    bool enabled = true;
+    size_t min_size = 128;
+};
+
+static CompressionPolicy g_compressionPolicy;
+static std::unordered_map<mrb_int, CompressionPolicy> g_channelCompressionPolicies;
+static std::vector<uint8_t> g_sendPayload;
+
+// Amount of channels the context is created with, and the reliability of sends that don't specify one
+constexpr mrb_int MAX_CHANNELS = 32;
+static int g_numChannels = 1;
+static std::vector<Unet::PacketType> g_channelPacketTypes;
+static std::vector<uint8_t> g_dictionaryPayload;
+
+// A packet that was serialized and compressed once with 'encode_packet', so it can be sent many times. It's
+// owned by an OService::EncodedPacket object, and freed along with it. The value is kept in an instance variable,
+// so the packet can be encoded again when the compression dictionary it was compressed with is replaced.
+struct EncodedPacket {
+    std::vector<uint8_t> payload;
+    mrb_int channel = -1;
+    uint32_t dictionary_hash = 0;
+    bool freed = false;
+};
+
+static void free_encoded_packet(mrb_state* mrb, void* ptr) {
+    delete (EncodedPacket*)ptr;
+}
+
+static const mrb_data_type encoded_packet_type = { "EncodedPacket", free_encoded_packet };
+static RClass* encoded_packet_class = nullptr;
+
+// Snapshot streams we send, by channel, and the ones we receive, by sending peer and channel
+static std::unordered_map<mrb_int, SnapshotSender> g_snapshotSenders;
+static std::map<std::pair<int, mrb_int>, SnapshotReceiver> g_snapshotReceivers;
+static std::vector<uint8_t> g_snapshotPayload;
+
+// Key interning is opt-in with 'set_interned_keys'. Every connection has its own tables, by peer and channel.
+static bool g_keyInterning = false;
+static InternTable g_internTable;
+static std::map<std::pair<int, mrb_int>, InternEncoder> g_internEncoders;
+static std::map<std::pair<int, mrb_int>, InternDecoder> g_internDecoders;
+static std::vector<uint8_t> g_internPayload;
+
+// With batching enabled, the messages of a channel are delivered as one on_data_batch_received event per tick,
+// made of [peer, service, data] triples in a flat array
+static bool g_batchDataReceived = false;
+static bool g_hasDataBatch = false;
+static mrb_value g_dataBatch;
+static std::unordered_map<int, mrb_value> g_serviceNameValues;
+
 std::string get_argv(mrb_state* state);
+void reset_peer_state();
+void remove_peer_state(int peer);
 
 #include "Callbacks.h"
 
@@ -100,13 +174,488 @@ std::string rnd_string_n(int length) {
     return rnd_string_64().substr(0, length);
 }
 
+// Resolves the reliability argument of the send functions. Without one, the default of the channel is used.
+bool get_packet_type(mrb_sym rel_type, mrb_int channel, Unet::PacketType& type) {
+    if (rel_type == 0) {
+        if (channel >= 0 && channel < (mrb_int)g_channelPacketTypes.size()) {
+            type = g_channelPacketTypes[channel];
+        } else {
+            type = Unet::PacketType::Reliable;
+        }
+        return true;
+    }
+
+    if (rel_type == os_reliable) {
+        type = Unet::PacketType::Reliable;
+    } else if (rel_type == os_unreliable) {
+        type = Unet::PacketType::Unreliable;
+    } else if (rel_type == os_unsequenced) {
+        type = Unet::PacketType::Unsequenced;
+    } else if (rel_type == os_unreliable_fragment) {
+        type = Unet::PacketType::UnreliableFragment;
+    } else if (rel_type == os_latest_only) {
+        type = Unet::PacketType::LatestOnly;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const CompressionPolicy& get_compression_policy(mrb_int channel) {
+    auto it = g_channelCompressionPolicies.find(channel);
+    if (it == g_channelCompressionPolicies.end()) {
+        return g_compressionPolicy;
+    }
+    return it->second;
+}
+
+bool dictionary_compress(const uint8_t* raw, size_t raw_size, uint8_t flags, std::vector<uint8_t>& out) {
+    auto& codec = g_ctx->GetDictionaryCodec();
+    if (!codec.HasDictionary() || !codec.Compress(raw, raw_size, g_dictionaryPayload)) {
+        return false;
+    }
+
+    out.resize(2 + g_dictionaryPayload.size());
+    out[0] = PAYLOAD_DICTIONARY | flags;
+    out[1] = (uint8_t)codec.GetDictionaryHash();
+    memcpy(out.data() + 2, g_dictionaryPayload.data(), g_dictionaryPayload.size());
+    return true;
+}
+
+// Like encode_payload, but for bytes that aren't an OSSP buffer, which can only be compressed with the dictionary
+void encode_bytes(const uint8_t* raw, size_t raw_size, mrb_int channel, uint8_t flags, std::vector<uint8_t>& out) {
+    out.clear();
+    out.push_back(PAYLOAD_RAW | flags);
+    out.insert(out.end(), raw, raw + raw_size);
+
+    if (get_compression_policy(channel).enabled) {
+        dictionary_compress(raw, raw_size, flags, out);
+    }
+}
+
+std::string serialize_value(mrb_state* mrb, mrb_value value) {
+    auto buffer = ByteBuffer();
+    OSSP::Serialize(&buffer, mrb, value);
+    return std::string((const char*)buffer.Data(), buffer.Size());
+}
+
+bool deserialize_value(mrb_state* mrb, const std::string& data, mrb_value& out) {
+    auto buffer = ByteBuffer((uint8_t*)data.data(), data.size(), false);
+    auto result = OSSP::Deserialize(&buffer, mrb);
+    if (!result) {
+        LOG_ERROR(generate_OSSP_error_message(result.error()));
+        return false;
+    }
+
+    out = result.value<>();
+    if (mrb_type(out) == MRB_TT_ARRAY && RARRAY_LEN(out) > 0) {
+        out = RARRAY_PTR(out)[0];
+    }
+    return true;
+}
+
+// Hashes and arrays nested deeper than this are diffed as a whole, which also stops at cyclic values
+constexpr int MAX_SNAPSHOT_DEPTH = 32;
+
+// Adds an entry for the value at the path to the snapshot, and one for every element if it's a hash or an array
+void flatten_snapshot(mrb_state* mrb, mrb_value value, std::string& path, int depth, SnapshotState& state) {
+    auto type = mrb_type(value);
+    if (depth >= MAX_SNAPSHOT_DEPTH || (type != MRB_TT_HASH && type != MRB_TT_ARRAY)) {
+        state[path] = (char)SNAPSHOT_VALUE + serialize_value(mrb, value);
+        return;
+    }
+
+    size_t path_size = path.size();
+    if (type == MRB_TT_HASH) {
+        state[path] = std::string(1, SNAPSHOT_HASH);
+        auto keys = mrb_hash_keys(mrb, value);
+        auto num_keys = RARRAY_LEN(keys);
+        for (mrb_int i = 0; i < num_keys; i++) {
+            auto key = RARRAY_PTR(keys)[i];
+            append_snapshot_path(path, SNAPSHOT_PATH_KEY, serialize_value(mrb, key));
+            flatten_snapshot(mrb, mrb_hash_get(mrb, value, key), path, depth + 1, state);
+            path.resize(path_size);
+        }
+    } else {
+        state[path] = std::string(1, SNAPSHOT_ARRAY);
+        auto count = RARRAY_LEN(value);
+        for (mrb_int i = 0; i < count; i++) {
+            append_snapshot_index(path, (uint32_t)i);
+            flatten_snapshot(mrb, RARRAY_PTR(value)[i], path, depth + 1, state);
+            path.resize(path_size);
+        }
+    }
+}
+
+// Rebuilds the hash from the entries of a snapshot. Returns false if they don't describe a valid value.
+bool rebuild_snapshot(mrb_state* mrb, const SnapshotState& state, mrb_value& out) {
+    struct Level {
+        const std::string* path;
+        mrb_value container;
+    };
+    std::vector<Level> levels;
+
+    // Parents sort right before their children, so every entry belongs to the innermost container whose path
+    // is a prefix of its own
+    out = mrb_hash_new_capa(mrb, 0);
+    std::string bytes;
+    for (auto& pair : state) {
+        auto& path = pair.first;
+        auto& value = pair.second;
+        if (value.empty()) {
+            return false;
+        }
+
+        mrb_value element;
+        if (value[0] == SNAPSHOT_HASH) {
+            element = mrb_hash_new_capa(mrb, 0);
+        } else if (value[0] == SNAPSHOT_ARRAY) {
+            element = mrb_ary_new_capa(mrb, 0);
+        } else if (value[0] != SNAPSHOT_VALUE || !deserialize_value(mrb, value.substr(1), element)) {
+            return false;
+        }
+
+        if (path.empty()) {
+            if (mrb_type(element) != MRB_TT_HASH) {
+                return false;
+            }
+            out = element;
+            levels.assign(1, Level { &path, element });
+            continue;
+        }
+
+        while (!levels.empty() && (levels.back().path->size() >= path.size() ||
+                                   path.compare(0, levels.back().path->size(), *levels.back().path) != 0)) {
+            levels.pop_back();
+        }
+        if (levels.empty()) {
+            return false;
+        }
+
+        // The rest of the path has to be a single component, otherwise an entry in between is missing
+        auto parent = levels.back().container;
+        size_t offset = levels.back().path->size();
+        SnapshotPathKind kind;
+        if (!read_snapshot_path(path, offset, kind, bytes) || offset != path.size()) {
+            return false;
+        }
+
+        if (mrb_type(parent) == MRB_TT_HASH && kind == SNAPSHOT_PATH_KEY) {
+            mrb_value key;
+            if (!deserialize_value(mrb, bytes, key)) {
+                return false;
+            }
+            mrb_hash_set(mrb, parent, key, element);
+        } else if (mrb_type(parent) == MRB_TT_ARRAY && kind == SNAPSHOT_PATH_INDEX) {
+            // Elements arrive in order, so anything else would leave a gap
+            uint32_t index;
+            if (!read_snapshot_index(bytes, index) || index != (uint32_t)RARRAY_LEN(parent)) {
+                return false;
+            }
+            mrb_ary_push(mrb, parent, element);
+        } else {
+            return false;
+        }
+
+        if (value[0] != SNAPSHOT_VALUE) {
+            levels.push_back(Level { &path, element });
+        }
+    }
+    return true;
+}
+
+// Sends a snapshot of the hash to the members. Every member gets a delta against the last snapshot it
+// acknowledged, or the full snapshot if there is none.
+void send_snapshot(mrb_state* mrb, mrb_value data, mrb_int channel, Unet::PacketType type, const std::vector<Unet::LobbyMember*>& members) {
+    SnapshotState state;
+    std::string path;
+    flatten_snapshot(mrb, data, path, 0, state);
+
+    auto& sender = g_snapshotSenders[channel];
+    uint32_t snapshot = sender.push(std::move(state));
+
+    // Members that acknowledged the same snapshot get the same delta, so it's only encoded once per baseline
+    std::map<uint32_t, std::vector<Unet::LobbyMember*>> groups;
+    for (auto member : members) {
+        groups[sender.get_baseline(member->UnetPeer)].push_back(member);
+    }
+
+    for (auto& group : groups) {
+        sender.encode(snapshot, group.first, g_snapshotPayload);
+        encode_bytes(g_snapshotPayload.data(), g_snapshotPayload.size(), channel, PAYLOAD_SNAPSHOT, g_sendPayload);
+        for (auto member : group.second) {
+            g_ctx->SendTo(member, g_sendPayload.data(), g_sendPayload.size(), type, channel);
+        }
+    }
+}
+
+// Handles a received snapshot or acknowledgement. Returns true if a snapshot was received, in which case out
+// is set to the rebuilt hash.
+bool receive_snapshot(mrb_state* mrb, Unet::NetworkMessage* msg, uint8_t flag, const uint8_t* payload, size_t payload_size, mrb_value& out) {
+    if ((flag & PAYLOAD_MODE_MASK) == PAYLOAD_COMPRESSED) {
+        LOG_ERROR("Received a snapshot with an unsupported compression mode.");
+        return false;
+    }
+
+    auto current_lobby = g_ctx->CurrentLobby();
+    if (current_lobby == nullptr) {
+        return false;
+    }
+    auto member = current_lobby->GetMember(msg->m_peer);
+    if (member == nullptr) {
+        LOG_ERROR("Received a snapshot from an unknown member.");
+        return false;
+    }
+
+    if (flag & PAYLOAD_SNAPSHOT_ACK) {
+        uint32_t snapshot;
+        if (payload_size < 4) {
+            return false;
+        }
+        snapshot = (uint32_t)payload[0] | ((uint32_t)payload[1] << 8) | ((uint32_t)payload[2] << 16) | ((uint32_t)payload[3] << 24);
+        g_snapshotSenders[msg->m_channel].acknowledge(member->UnetPeer, snapshot);
+        return false;
+    }
+
+    auto& receiver = g_snapshotReceivers[{ member->UnetPeer, (mrb_int)msg->m_channel }];
+    uint32_t snapshot;
+    if (!receiver.decode(payload, payload_size, snapshot)) {
+        // Either outdated, or based on a snapshot we never got, in which case the sender falls back to a full one
+        return false;
+    }
+
+    uint8_t ack[5];
+    ack[0] = PAYLOAD_RAW | PAYLOAD_SNAPSHOT_ACK;
+    // Little endian, like the snapshots themselves
+    for (int i = 0; i < 4; i++) {
+        ack[1 + i] = (uint8_t)(snapshot >> (i * 8));
+    }
+    g_ctx->SendTo(member, ack, sizeof(ack), Unet::PacketType::Unreliable, msg->m_channel);
+
+    if (!rebuild_snapshot(mrb, receiver.get_latest(), out)) {
+        LOG_ERROR("Received a snapshot that doesn't describe a valid hash.");
+        return false;
+    }
+    return true;
+}
+
+// Handles a payload encoded with the key interning table of the sending connection
+bool receive_interned(mrb_state* mrb, Unet::NetworkMessage* msg, uint8_t flag, const uint8_t* payload, size_t payload_size, mrb_value& out) {
+    if ((flag & PAYLOAD_MODE_MASK) == PAYLOAD_COMPRESSED) {
+        LOG_ERROR("Received an interned payload with an unsupported compression mode.");
+        return false;
+    }
+
+    auto current_lobby = g_ctx->CurrentLobby();
+    if (current_lobby == nullptr) {
+        return false;
+    }
+    auto member = current_lobby->GetMember(msg->m_peer);
+    if (member == nullptr) {
+        LOG_ERROR("Received an interned payload from an unknown member.");
+        return false;
+    }
+
+    auto key = std::make_pair(member->UnetPeer, (mrb_int)msg->m_channel);
+
+    if (flag & PAYLOAD_INTERNED_ACK) {
+        auto encoder = g_internEncoders.find(key);
+        if (encoder != g_internEncoders.end() && !encoder->second.acknowledge(payload, payload_size)) {
+            LOG_ERROR("Received a malformed interned key acknowledgement.");
+        }
+        return false;
+    }
+
+    auto it = g_internDecoders.find(key);
+    if (it == g_internDecoders.end()) {
+        it = g_internDecoders.emplace(key, InternDecoder(mrb, g_internTable)).first;
+    }
+
+    if (!it->second.decode(mrb, payload, payload_size, out)) {
+        LOG_ERROR("Couldn't decode an interned payload. Are both sides using the same interned keys?");
+        return false;
+    }
+
+    // Sent for every payload that defines keys, so a lost acknowledgement is made up for by the next definition
+    g_internPayload.clear();
+    g_internPayload.push_back(PAYLOAD_RAW | PAYLOAD_INTERNED | PAYLOAD_INTERNED_ACK);
+    if (it->second.write_acknowledgement(g_internPayload)) {
+        g_ctx->SendTo(member, g_internPayload.data(), g_internPayload.size(), Unet::PacketType::Unreliable, msg->m_channel);
+    }
+    return true;
+}
+
+template<typename T>
+static void erase_peer_entries(std::map<std::pair<int, mrb_int>, T>& map, int peer) {
+    for (auto it = map.begin(); it != map.end();) {
+        if (it->first.first == peer) {
+            it = map.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// Drops the snapshot and key interning state of all connections
+void reset_peer_state() {
+    g_snapshotSenders.clear();
+    g_snapshotReceivers.clear();
+    g_internEncoders.clear();
+    g_internDecoders.clear();
+}
+
+void remove_peer_state(int peer) {
+    for (auto& pair : g_snapshotSenders) {
+        pair.second.remove_peer(peer);
+    }
+    erase_peer_entries(g_snapshotReceivers, peer);
+    erase_peer_entries(g_internEncoders, peer);
+    erase_peer_entries(g_internDecoders, peer);
+}
+
+// Service names are handed out with every batched message, so they're created once, frozen and kept alive
+mrb_value get_service_name_value(mrb_state* mrb, Unet::ServiceType service) {
+    auto it = g_serviceNameValues.find((int)service);
+    if (it != g_serviceNameValues.end()) {
+        return it->second;
+    }
+
+    auto name = mrb_str_new_cstr(mrb, GetServiceNameByType(service));
+    mrb_obj_freeze(mrb, name);
+    mrb_gc_register(mrb, name);
+    g_serviceNameValues[(int)service] = name;
+    return name;
+}
+
+void push_data_received(mrb_state* mrb, Unet::NetworkMessage* msg, mrb_value value) {
+    if (g_batchDataReceived) {
+        if (!g_hasDataBatch) {
+            // Only referenced from here until it's pushed, so it has to be protected from the GC meanwhile
+            g_dataBatch = mrb_ary_new(mrb);
+            mrb_gc_register(mrb, g_dataBatch);
+            g_hasDataBatch = true;
+        }
+
+        auto current_lobby = g_ctx->CurrentLobby();
+        auto member = current_lobby != nullptr ? current_lobby->GetMember(msg->m_peer) : nullptr;
+        mrb_ary_push(mrb, g_dataBatch, mrb_int_value(mrb, member != nullptr ? member->UnetPeer : -1));
+        mrb_ary_push(mrb, g_dataBatch, get_service_name_value(mrb, msg->m_peer.Service));
+        mrb_ary_push(mrb, g_dataBatch, value);
+        return;
+    }
+
+    auto mrb_data = mrb_hash_new_capa(mrb, 3);
+    pext_hash_set(mrb, mrb_data, "data", value);
+    auto peer = mrb_hash_new_capa(mrb, 2);
+    pext_hash_set(mrb, peer, "id",
+                  std::to_string(msg->m_peer.ID));
+    pext_hash_set(mrb, peer, "service",
+                  GetServiceNameByType(msg->m_peer.Service));
+    pext_hash_set(mrb, mrb_data, "peer", peer);
+    pext_hash_set(mrb, mrb_data, "channel", msg->m_channel);
+    push_to_updates(on_data_received, mrb_data);
+}
+
+// Delivers the messages batched for the channel, if there are any
+void push_data_batch(mrb_state* mrb, int channel) {
+    if (!g_hasDataBatch) {
+        return;
+    }
+
+    auto mrb_data = mrb_hash_new_capa(mrb, 2);
+    pext_hash_set(mrb, mrb_data, "channel", channel);
+    pext_hash_set(mrb, mrb_data, "messages", g_dataBatch);
+    push_to_updates(on_data_batch_received, mrb_data);
+    mrb_gc_unregister(mrb, g_dataBatch);
+    g_hasDataBatch = false;
+}
+
+void encode_payload(mrb_state* mrb, mrb_value data, mrb_int channel, std::vector<uint8_t>& out) {
+    auto buffer = ByteBuffer();
+    OSSP::Serialize(&buffer, mrb, data);
+
+    auto raw_ptr = (const uint8_t*)buffer.Data();
+    size_t raw_size = buffer.Size();
+
+    out.clear();
+    out.push_back(PAYLOAD_RAW);
+    out.insert(out.end(), raw_ptr, raw_ptr + raw_size);
+
+    auto& policy = get_compression_policy(channel);
+    if (!policy.enabled) {
+        return;
+    }
+
+    // Dictionary compression pays off even for tiny packets, so it's tried regardless of the minimum size
+    if (dictionary_compress(raw_ptr, raw_size, 0, out)) {
+        return;
+    }
+
+    if (raw_size < policy.min_size) {
+        return;
+    }
+
+    if (!buffer.Compress()) {
+        LOG_ERROR("Compression failed!");
+        return;
+    }
+
+    size_t compressed_size = buffer.Size();
+    if (compressed_size >= raw_size) {
+        return;
+    }
+
+    auto compressed_ptr = (const uint8_t*)buffer.Data();
+    out.resize(1 + compressed_size);
+    out[0] = PAYLOAD_COMPRESSED;
+    memcpy(out.data() + 1, compressed_ptr, compressed_size);
+}
+
+// Like encode_payload, but for a single member, using the key interning table of that connection if enabled
+void encode_payload_for(mrb_state* mrb, mrb_value data, mrb_int channel, Unet::LobbyMember* member, std::vector<uint8_t>& out) {
+    if (g_keyInterning) {
+        auto key = std::make_pair(member->UnetPeer, channel);
+        auto it = g_internEncoders.find(key);
+        if (it == g_internEncoders.end()) {
+            it = g_internEncoders.emplace(key, InternEncoder(g_internTable)).first;
+        }
+
+        if (it->second.encode(mrb, data, g_internPayload)) {
+            encode_bytes(g_internPayload.data(), g_internPayload.size(), channel, PAYLOAD_INTERNED, out);
+            return;
+        }
+    }
+
+    encode_payload(mrb, data, channel, out);
+}
+
+std::vector<uint8_t>* get_encoded_packet(mrb_state* mrb, mrb_value value) {
+    auto packet = (EncodedPacket*)mrb_data_check_get_ptr(mrb, value, &encoded_packet_type);
+    if (packet == nullptr) {
+        LOG_ERROR("Expected a packet returned by 'encode_packet'.");
+        return nullptr;
+    }
+    if (packet->freed || packet->payload.empty()) {
+        LOG_ERROR("Encoded packet was already freed.");
+        return nullptr;
+    }
+
+    // Receivers can only decompress it with the dictionary that is current now
+    auto& codec = g_ctx->GetDictionaryCodec();
+    if ((packet->payload[0] & PAYLOAD_MODE_MASK) == PAYLOAD_DICTIONARY && packet->dictionary_hash != codec.GetDictionaryHash()) {
+        encode_payload(mrb, mrb_iv_get(mrb, value, mrb_intern_lit(mrb, "@value")), packet->channel, packet->payload);
+        packet->dictionary_hash = codec.GetDictionaryHash();
+    }
+    return &packet->payload;
+}
+
 inline uint64_t pext_symbol_komihash(mrb_state* state, mrb_sym symbol) {
     const auto sym_str = mrb_sym_name(state, symbol);
     return komihash(sym_str, strlen(sym_str), 0);
 }
 
 void init_unet() {
-    g_ctx = Unet::CreateContext();
+    g_ctx = Unet::CreateContext(g_numChannels);
     g_ctx->SetCallbacks(new RubyCallbacks);
 
     #if defined(UNET_MODULE_STEAM)
@@ -134,6 +683,9 @@ void init_unet() {
 }
 
 void register_ruby_calls(mrb_state* state, RClass* module) {
+    encoded_packet_class = mrb_define_class_under(state, module, "EncodedPacket", mrb_class_get(state, "Object"));
+    MRB_SET_INSTANCE_TT(encoded_packet_class, MRB_TT_DATA);
+
     mrb_define_module_function(state, module, "__update_service", {
                                    [](mrb_state* mrb, mrb_value self) {
                                        update_state = mrb;
@@ -152,19 +704,73 @@ void register_ruby_calls(mrb_state* state, RClass* module) {
                                        }
                                        #endif
                                        g_ctx->RunCallbacks();
-                                       const int max_channels = 1;
-                                       for (int i = 0; i < max_channels; ++i) {
+                                       for (int i = 0; i < g_numChannels; ++i) {
                                            auto data = g_ctx->ReadMessage(i);
                                            while (data != nullptr) {
 
-                                               auto buffer = ByteBuffer(data.get()->m_data, data.get()->m_size, false);
-                                               buffer.Uncompress();
+                                               if (data.get()->m_size < 1) {
+                                                   LOG_ERROR("Received an empty payload.");
+                                                   data = g_ctx->ReadMessage(i);
+                                                   continue;
+                                               }
+
+                                               auto flag = data.get()->m_data[0];
+                                               auto mode = flag & PAYLOAD_MODE_MASK;
+                                               uint8_t* payload = data.get()->m_data + 1;
+                                               size_t payload_size = data.get()->m_size - 1;
+
+                                               if (mode == PAYLOAD_DICTIONARY) {
+                                                   auto& codec = g_ctx->GetDictionaryCodec();
+                                                   if (payload_size < 1 || payload[0] != (uint8_t)codec.GetDictionaryHash() ||
+                                                       !codec.Decompress(payload + 1, payload_size - 1, g_dictionaryPayload)) {
+                                                       LOG_ERROR("Couldn't decompress payload with the current compression dictionary.");
+                                                       data = g_ctx->ReadMessage(i);
+                                                       continue;
+                                                   }
+                                                   payload = g_dictionaryPayload.data();
+                                                   payload_size = g_dictionaryPayload.size();
+                                               }
+
+                                               if (flag & PAYLOAD_INTERNED) {
+                                                   mrb_value interned_value;
+                                                   if (receive_interned(mrb, data.get(), flag, payload, payload_size, interned_value)) {
+                                                       push_data_received(mrb, data.get(), interned_value);
+                                                   }
+                                                   data = g_ctx->ReadMessage(i);
+                                                   continue;
+                                               }
+
+                                               if (flag & (PAYLOAD_SNAPSHOT | PAYLOAD_SNAPSHOT_ACK)) {
+                                                   mrb_value snapshot_value;
+                                                   if (receive_snapshot(mrb, data.get(), flag, payload, payload_size, snapshot_value)) {
+                                                       push_data_received(mrb, data.get(), snapshot_value);
+                                                   }
+                                                   data = g_ctx->ReadMessage(i);
+                                                   continue;
+                                               }
+
+                                               auto buffer = ByteBuffer(payload, payload_size, false);
+                                               if (mode == PAYLOAD_COMPRESSED) {
+                                                   buffer.Uncompress();
+                                               } else if (mode != PAYLOAD_RAW && mode != PAYLOAD_DICTIONARY) {
+                                                   LOG_ERROR("Received a payload with an unknown compression flag.");
+                                                   data = g_ctx->ReadMessage(i);
+                                                   continue;
+                                               }
 
                                                auto result = OSSP::Deserialize(&buffer, mrb);
 
                                                if (!result) {
                                                    auto error = generate_OSSP_error_message(result.error());
+                                                   if (g_batchDataReceived) {
+                                                       // Raising would skip delivering the batch collected so far, and leave it registered with the GC
+                                                       LOG_ERROR(error);
+                                                       data = g_ctx->ReadMessage(i);
+                                                       continue;
+                                                   }
                                                    std::cout << error << std::endl;
+                                                   // mrb_raise doesn't return, so the message has to be released first
+                                                   data.reset();
                                                    mrb_raise(mrb, E_RUNTIME_ERROR, error.c_str());
                                                }
 
@@ -177,18 +783,10 @@ void register_ruby_calls(mrb_state* state, RClass* module) {
                                                    }
                                                }
 
-                                               auto mrb_data = mrb_hash_new_capa(mrb, 3);
-                                               pext_hash_set(mrb, mrb_data, "data", deserialized_data);
-                                               auto peer = mrb_hash_new_capa(mrb, 2);
-                                               pext_hash_set(mrb, peer, "id",
-                                                             std::to_string(data.get()->m_peer.ID));
-                                               pext_hash_set(mrb, peer, "service",
-                                                             GetServiceNameByType(data.get()->m_peer.Service));
-                                               pext_hash_set(mrb, mrb_data, "peer", peer);
-                                               pext_hash_set(mrb, mrb_data, "channel", data.get()->m_channel);
-                                               push_to_updates(on_data_received, mrb_data);
+                                               push_data_received(mrb, data.get(), deserialized_data);
                                                data = g_ctx->ReadMessage(i);
                                            }
+                                           push_data_batch(mrb, i);
                                        }
 
                                        auto m_array = mrb_ary_new_capa(mrb, value_list.size());
@@ -426,7 +1024,7 @@ void register_ruby_calls(mrb_state* state, RClass* module) {
                                    [](mrb_state* mrb, mrb_value self) {
                                        mrb_value data;
                                        mrb_int channel = 0;
-                                       mrb_sym rel_type = os_reliable;
+                                       mrb_sym rel_type = 0;
                                        mrb_get_args(mrb, "o|in", &data, &channel, &rel_type);
                                        auto current_lobby = g_ctx->CurrentLobby();
                                        if (current_lobby == nullptr) {
@@ -439,25 +1037,14 @@ void register_ruby_calls(mrb_state* state, RClass* module) {
                                            return mrb_nil_value();
                                        }
 
-                                       auto buffer = ByteBuffer();
-                                       OSSP::Serialize(&buffer, mrb, data);
-                                       if (!buffer.Compress()) {
-                                           //LOG_ERROR("Compression failed!");
-                                           ERR_BIN_BUFF
-                                           return mrb_nil_value();
-                                       }
-
-                                       auto type = Unet::PacketType::Reliable;
-                                       if (rel_type == os_reliable) {
-                                           type = Unet::PacketType::Reliable;
-                                       } else if (rel_type == os_unreliable) {
-                                           type = Unet::PacketType::Unreliable;
-                                       } else {
+                                       Unet::PacketType type;
+                                       if (!get_packet_type(rel_type, channel, type)) {
                                            ERR_INV_PACKET
                                            return mrb_nil_value();
                                        }
 
-                                       g_ctx->SendToHost((uint8_t*)buffer.Data(), buffer.Size(), type, channel);
+                                       encode_payload_for(mrb, data, channel, host, g_sendPayload);
+                                       g_ctx->SendToHost(g_sendPayload.data(), g_sendPayload.size(), type, channel);
                                        return mrb_nil_value();
                                    }
                                }, MRB_ARGS_REQ(1) | MRB_ARGS_OPT(2));
@@ -471,7 +1058,7 @@ void register_ruby_calls(mrb_state* state, RClass* module) {
                                        mrb_value data;
                                        mrb_int peer;
                                        mrb_int channel = 0;
-                                       mrb_sym rel_type = os_reliable;
+                                       mrb_sym rel_type = 0;
                                        mrb_get_args(mrb, "oi|in", &data, &peer, &channel, &rel_type);
                                        auto current_lobby = g_ctx->CurrentLobby();
                                        if (current_lobby == nullptr) {
@@ -480,25 +1067,19 @@ void register_ruby_calls(mrb_state* state, RClass* module) {
                                        }
 
                                        auto member = g_ctx->CurrentLobby()->GetMember(peer);
-
-                                       auto buffer = ByteBuffer();
-                                       OSSP::Serialize(&buffer, mrb, data);
-                                       if (!buffer.Compress()) {
-                                           LOG_ERROR("Compression failed!");
+                                       if (member == nullptr) {
+                                           LOG_ERROR("Member not found by peer.");
                                            return mrb_nil_value();
                                        }
 
-                                       auto type = Unet::PacketType::Reliable;
-                                       if (rel_type == os_reliable) {
-                                           type = Unet::PacketType::Reliable;
-                                       } else if (rel_type == os_unreliable) {
-                                           type = Unet::PacketType::Unreliable;
-                                       } else {
+                                       Unet::PacketType type;
+                                       if (!get_packet_type(rel_type, channel, type)) {
                                            ERR_INV_PACKET
                                            return mrb_nil_value();
                                        }
 
-                                       g_ctx->SendTo(member, (uint8_t*)buffer.Data(), buffer.Size(), type, channel);
+                                       encode_payload_for(mrb, data, channel, member, g_sendPayload);
+                                       g_ctx->SendTo(member, g_sendPayload.data(), g_sendPayload.size(), type, channel);
                                        return mrb_nil_value();
                                    }
                                }, MRB_ARGS_REQ(2) | MRB_ARGS_OPT(2));
@@ -511,7 +1092,7 @@ void register_ruby_calls(mrb_state* state, RClass* module) {
                                        }
                                        mrb_value data;
                                        mrb_int channel = 0;
-                                       mrb_sym rel_type = os_reliable;
+                                       mrb_sym rel_type = 0;
                                        mrb_get_args(mrb, "o|in", &data, &channel, &rel_type);
                                        auto current_lobby = g_ctx->CurrentLobby();
                                        if (current_lobby == nullptr) {
@@ -519,24 +1100,413 @@ void register_ruby_calls(mrb_state* state, RClass* module) {
                                            return mrb_nil_value();
                                        }
 
-                                       auto buffer = ByteBuffer();
-                                       OSSP::Serialize(&buffer, mrb, data);
-                                       if (!buffer.Compress()) {
-                                           LOG_ERROR("Compression failed!");
+                                       Unet::PacketType type;
+                                       if (!get_packet_type(rel_type, channel, type)) {
+                                           ERR_INV_PACKET
+                                           return mrb_nil_value();
+                                       }
+
+                                       if (g_keyInterning) {
+                                           // Every connection has its own interning table, so the payload is encoded per member
+                                           for (auto member : current_lobby->GetMembers()) {
+                                               if (member->UnetPeer != g_ctx->GetLocalPeer()) {
+                                                   encode_payload_for(mrb, data, channel, member, g_sendPayload);
+                                                   g_ctx->SendTo(member, g_sendPayload.data(), g_sendPayload.size(), type, channel);
+                                               }
+                                           }
                                            return mrb_nil_value();
                                        }
 
-                                       auto type = Unet::PacketType::Reliable;
-                                       if (rel_type == os_reliable) {
-                                           type = Unet::PacketType::Reliable;
-                                       } else if (rel_type == os_unreliable) {
-                                           type = Unet::PacketType::Unreliable;
+                                       encode_payload(mrb, data, channel, g_sendPayload);
+                                       g_ctx->SendToAll(g_sendPayload.data(), g_sendPayload.size(), type, channel);
+                                       return mrb_nil_value();
+                                   }
+                               }, MRB_ARGS_REQ(1) | MRB_ARGS_OPT(2));
+
+    mrb_define_module_function(state, module, "encode_packet", {
+                                   [](mrb_state* mrb, mrb_value self) {
+                                       mrb_value data;
+                                       mrb_int channel = -1;
+                                       mrb_get_args(mrb, "o|i", &data, &channel);
+
+                                       // Owned by the object before encoding, so it isn't leaked if serializing raises
+                                       auto packet = new EncodedPacket();
+                                       auto object = mrb_obj_value(mrb_data_object_alloc(mrb, encoded_packet_class, packet, &encoded_packet_type));
+                                       mrb_iv_set(mrb, object, mrb_intern_lit(mrb, "@value"), data);
+
+                                       packet->channel = channel;
+                                       encode_payload(mrb, data, channel, packet->payload);
+                                       packet->dictionary_hash = g_ctx->GetDictionaryCodec().GetDictionaryHash();
+                                       return object;
+                                   }
+                               }, MRB_ARGS_REQ(1) | MRB_ARGS_OPT(1));
+
+    mrb_define_module_function(state, module, "set_data_batching", {
+                                   [](mrb_state* mrb, mrb_value self) {
+                                       mrb_bool enabled;
+                                       mrb_get_args(mrb, "b", &enabled);
+                                       g_batchDataReceived = enabled;
+                                       return mrb_nil_value();
+                                   }
+                               }, MRB_ARGS_REQ(1));
+
+    mrb_define_module_function(state, module, "set_channel_queue_policy", {
+                                   [](mrb_state* mrb, mrb_value self) {
+                                       mrb_int channel;
+                                       mrb_sym policy_sym;
+                                       mrb_int max_messages = 0;
+                                       mrb_get_args(mrb, "in|i", &channel, &policy_sym, &max_messages);
+
+                                       auto policy = Unet::QueuePolicy::Fifo;
+                                       if (policy_sym == os_fifo) {
+                                           policy = Unet::QueuePolicy::Fifo;
+                                       } else if (policy_sym == os_drop_oldest) {
+                                           policy = Unet::QueuePolicy::DropOldest;
+                                       } else if (policy_sym == os_latest_per_peer) {
+                                           policy = Unet::QueuePolicy::LatestPerPeer;
                                        } else {
+                                           LOG_ERROR("Unknown queue policy.");
+                                           return mrb_nil_value();
+                                       }
+
+                                       if (max_messages < 0) {
+                                           max_messages = 0;
+                                       }
+                                       g_ctx->SetChannelQueuePolicy((int)channel, policy, (size_t)max_messages);
+                                       return mrb_nil_value();
+                                   }
+                               }, MRB_ARGS_REQ(2) | MRB_ARGS_OPT(1));
+
+    mrb_define_module_function(state, module, "set_channel_coalescing", {
+                                   [](mrb_state* mrb, mrb_value self) {
+                                       mrb_int channel;
+                                       mrb_bool enabled;
+                                       mrb_get_args(mrb, "ib", &channel, &enabled);
+                                       g_ctx->SetChannelCoalescing((int)channel, enabled);
+                                       return mrb_nil_value();
+                                   }
+                               }, MRB_ARGS_REQ(2));
+
+    mrb_define_module_function(state, module, "get_dropped_messages", {
+                                   [](mrb_state* mrb, mrb_value self) {
+                                       mrb_int channel;
+                                       mrb_get_args(mrb, "i", &channel);
+                                       return mrb_int_value(mrb, (mrb_int)g_ctx->GetDroppedMessages((int)channel));
+                                   }
+                               }, MRB_ARGS_REQ(1));
+
+    mrb_define_module_function(state, module, "set_interned_keys", {
+                                   [](mrb_state* mrb, mrb_value self) {
+                                       mrb_value keys;
+                                       mrb_get_args(mrb, "o", &keys);
+
+                                       // Tables built from the previous keys can't be used anymore
+                                       g_internEncoders.clear();
+                                       g_internDecoders.clear();
+
+                                       if (mrb_nil_p(keys)) {
+                                           g_keyInterning = false;
+                                           g_internTable.set({});
+                                           return mrb_nil_value();
+                                       }
+                                       if (mrb_type(keys) != MRB_TT_ARRAY) {
+                                           LOG_ERROR("Interned keys have to be an array of symbols and strings.");
+                                           return mrb_nil_value();
+                                       }
+
+                                       std::vector<InternedKey> interned;
+                                       auto num_keys = RARRAY_LEN(keys);
+                                       for (mrb_int i = 0; i < num_keys && i < MAX_INTERNED_KEYS; i++) {
+                                           auto key = RARRAY_PTR(keys)[i];
+                                           if (mrb_type(key) == MRB_TT_SYMBOL) {
+                                               interned.push_back({ mrb_sym_name(mrb, mrb_symbol(key)), true });
+                                           } else if (mrb_type(key) == MRB_TT_STRING) {
+                                               interned.push_back({ std::string(RSTRING_PTR(key), RSTRING_LEN(key)), false });
+                                           } else {
+                                               LOG_ERROR("Interned keys have to be an array of symbols and strings.");
+                                               return mrb_nil_value();
+                                           }
+                                       }
+
+                                       g_internTable.set(std::move(interned));
+                                       g_keyInterning = true;
+                                       return mrb_nil_value();
+                                   }
+                               }, MRB_ARGS_REQ(1));
+
+    mrb_define_module_function(state, module, "set_compression_policy", {
+                                   [](mrb_state* mrb, mrb_value self) {
+                                       mrb_int min_size;
+                                       mrb_bool enabled = true;
+                                       mrb_int channel = -1;
+                                       mrb_get_args(mrb, "i|bi", &min_size, &enabled, &channel);
+
+                                       CompressionPolicy policy;
+                                       policy.enabled = enabled;
+                                       policy.min_size = min_size < 0 ? 0 : (size_t)min_size;
+
+                                       if (channel < 0) {
+                                           g_compressionPolicy = policy;
+                                       } else {
+                                           g_channelCompressionPolicies[channel] = policy;
+                                       }
+                                       return mrb_nil_value();
+                                   }
+                               }, MRB_ARGS_REQ(1) | MRB_ARGS_OPT(2));
+
+    mrb_define_module_function(state, module, "set_compression_dictionary", {
+                                   [](mrb_state* mrb, mrb_value self) {
+                                       char* dictionary;
+                                       mrb_int size;
+                                       mrb_get_args(mrb, "s", &dictionary, &size);
+                                       g_ctx->SetCompressionDictionary((const uint8_t*)dictionary, (size_t)size);
+                                       return mrb_nil_value();
+                                   }
+                               }, MRB_ARGS_REQ(1));
+
+    mrb_define_module_function(state, module, "build_compression_dictionary", {
+                                   [](mrb_state* mrb, mrb_value self) {
+                                       mrb_value samples;
+                                       mrb_get_args(mrb, "A", &samples);
+
+                                       // The dictionary is just the serialized samples back to back. Later samples
+                                       // are closer to the packet being compressed, so the most common data should
+                                       // come last.
+                                       std::vector<uint8_t> dictionary;
+                                       auto num_samples = RARRAY_LEN(samples);
+                                       for (mrb_int i = 0; i < num_samples; i++) {
+                                           auto buffer = ByteBuffer();
+                                           OSSP::Serialize(&buffer, mrb, RARRAY_PTR(samples)[i]);
+                                           auto ptr = (const uint8_t*)buffer.Data();
+                                           dictionary.insert(dictionary.end(), ptr, ptr + buffer.Size());
+                                       }
+
+                                       size_t max_size = Unet::DictionaryCodec::MaxDictionarySize;
+                                       size_t offset = dictionary.size() > max_size ? dictionary.size() - max_size : 0;
+                                       return mrb_str_new(mrb, (const char*)dictionary.data() + offset, dictionary.size() - offset);
+                                   }
+                               }, MRB_ARGS_REQ(1));
+
+    mrb_define_module_function(state, module, "clear_compression_policy", {
+                                   [](mrb_state* mrb, mrb_value self) {
+                                       mrb_int channel;
+                                       mrb_get_args(mrb, "i", &channel);
+                                       return mrb_bool_value(g_channelCompressionPolicies.erase(channel) > 0);
+                                   }
+                               }, MRB_ARGS_REQ(1));
+
+    mrb_define_module_function(state, module, "free_packet", {
+                                   [](mrb_state* mrb, mrb_value self) {
+                                       // Frees the encoded data right away instead of waiting for the GC to collect the packet
+                                       mrb_value object;
+                                       mrb_get_args(mrb, "o", &object);
+                                       auto packet = (EncodedPacket*)mrb_data_check_get_ptr(mrb, object, &encoded_packet_type);
+                                       if (packet == nullptr || packet->freed) {
+                                           return mrb_false_value();
+                                       }
+                                       packet->freed = true;
+                                       std::vector<uint8_t>().swap(packet->payload);
+                                       mrb_iv_set(mrb, object, mrb_intern_lit(mrb, "@value"), mrb_nil_value());
+                                       return mrb_true_value();
+                                   }
+                               }, MRB_ARGS_REQ(1));
+
+    mrb_define_module_function(state, module, "send_packet_to_host", {
+                                   [](mrb_state* mrb, mrb_value self) {
+                                       mrb_value handle;
+                                       mrb_int channel = 0;
+                                       mrb_sym rel_type = 0;
+                                       mrb_get_args(mrb, "o|in", &handle, &channel, &rel_type);
+                                       auto current_lobby = g_ctx->CurrentLobby();
+                                       if (current_lobby == nullptr) {
+                                           LOG_ERROR("Not in a lobby.");
+                                           return mrb_nil_value();
+                                       }
+                                       auto host = current_lobby->GetHostMember();
+                                       if (host == nullptr) {
+                                           LOG_ERROR("No host available (yet).");
+                                           return mrb_nil_value();
+                                       }
+
+                                       auto packet = get_encoded_packet(mrb, handle);
+                                       if (packet == nullptr) {
+                                           return mrb_nil_value();
+                                       }
+
+                                       Unet::PacketType type;
+                                       if (!get_packet_type(rel_type, channel, type)) {
                                            ERR_INV_PACKET
                                            return mrb_nil_value();
                                        }
 
-                                       g_ctx->SendToAll((uint8_t*)buffer.Data(), buffer.Size(), type, channel);
+                                       g_ctx->SendToHost(packet->data(), packet->size(), type, channel);
+                                       return mrb_nil_value();
+                                   }
+                               }, MRB_ARGS_REQ(1) | MRB_ARGS_OPT(2));
+
+    mrb_define_module_function(state, module, "send_packet_to", {
+                                   [](mrb_state* mrb, mrb_value self) {
+                                       if (!g_ctx->IsHosting()) {
+                                           push_error("'send_packet_to' is only available for host!", -1);
+                                           return mrb_nil_value();
+                                       }
+                                       mrb_value handle;
+                                       mrb_int peer;
+                                       mrb_int channel = 0;
+                                       mrb_sym rel_type = 0;
+                                       mrb_get_args(mrb, "oi|in", &handle, &peer, &channel, &rel_type);
+                                       auto current_lobby = g_ctx->CurrentLobby();
+                                       if (current_lobby == nullptr) {
+                                           LOG_ERROR("Not in a lobby.");
+                                           return mrb_nil_value();
+                                       }
+
+                                       auto member = current_lobby->GetMember(peer);
+                                       if (member == nullptr) {
+                                           LOG_ERROR("Member not found by peer.");
+                                           return mrb_nil_value();
+                                       }
+
+                                       auto packet = get_encoded_packet(mrb, handle);
+                                       if (packet == nullptr) {
+                                           return mrb_nil_value();
+                                       }
+
+                                       Unet::PacketType type;
+                                       if (!get_packet_type(rel_type, channel, type)) {
+                                           ERR_INV_PACKET
+                                           return mrb_nil_value();
+                                       }
+
+                                       g_ctx->SendTo(member, packet->data(), packet->size(), type, channel);
+                                       return mrb_nil_value();
+                                   }
+                               }, MRB_ARGS_REQ(2) | MRB_ARGS_OPT(2));
+
+    mrb_define_module_function(state, module, "send_packet_to_members", {
+                                   [](mrb_state* mrb, mrb_value self) {
+                                       if (!g_ctx->IsHosting()) {
+                                           push_error("'send_packet_to_members' is only available for host!", -1);
+                                           return mrb_nil_value();
+                                       }
+                                       mrb_value handle;
+                                       mrb_int channel = 0;
+                                       mrb_sym rel_type = 0;
+                                       mrb_get_args(mrb, "o|in", &handle, &channel, &rel_type);
+                                       auto current_lobby = g_ctx->CurrentLobby();
+                                       if (current_lobby == nullptr) {
+                                           LOG_ERROR("Not in a lobby.");
+                                           return mrb_nil_value();
+                                       }
+
+                                       auto packet = get_encoded_packet(mrb, handle);
+                                       if (packet == nullptr) {
+                                           return mrb_nil_value();
+                                       }
+
+                                       Unet::PacketType type;
+                                       if (!get_packet_type(rel_type, channel, type)) {
+                                           ERR_INV_PACKET
+                                           return mrb_nil_value();
+                                       }
+
+                                       g_ctx->SendToAll(packet->data(), packet->size(), type, channel);
+                                       return mrb_nil_value();
+                                   }
+                               }, MRB_ARGS_REQ(1) | MRB_ARGS_OPT(2));
+
+    mrb_define_module_function(state, module, "send_snapshot_to_host", {
+                                   [](mrb_state* mrb, mrb_value self) {
+                                       mrb_value data;
+                                       mrb_int channel = 0;
+                                       mrb_sym rel_type = os_unreliable;
+                                       mrb_get_args(mrb, "H|in", &data, &channel, &rel_type);
+                                       auto current_lobby = g_ctx->CurrentLobby();
+                                       if (current_lobby == nullptr) {
+                                           LOG_ERROR("Not in a lobby.");
+                                           return mrb_nil_value();
+                                       }
+                                       auto host = current_lobby->GetHostMember();
+                                       if (host == nullptr) {
+                                           LOG_ERROR("No host available (yet).");
+                                           return mrb_nil_value();
+                                       }
+
+                                       Unet::PacketType type;
+                                       if (!get_packet_type(rel_type, channel, type)) {
+                                           ERR_INV_PACKET
+                                           return mrb_nil_value();
+                                       }
+
+                                       send_snapshot(mrb, data, channel, type, { host });
+                                       return mrb_nil_value();
+                                   }
+                               }, MRB_ARGS_REQ(1) | MRB_ARGS_OPT(2));
+
+    mrb_define_module_function(state, module, "send_snapshot_to", {
+                                   [](mrb_state* mrb, mrb_value self) {
+                                       if (!g_ctx->IsHosting()) {
+                                           push_error("'send_snapshot_to' is only available for host!", -1);
+                                           return mrb_nil_value();
+                                       }
+                                       mrb_value data;
+                                       mrb_int peer;
+                                       mrb_int channel = 0;
+                                       mrb_sym rel_type = os_unreliable;
+                                       mrb_get_args(mrb, "Hi|in", &data, &peer, &channel, &rel_type);
+                                       auto current_lobby = g_ctx->CurrentLobby();
+                                       if (current_lobby == nullptr) {
+                                           LOG_ERROR("Not in a lobby.");
+                                           return mrb_nil_value();
+                                       }
+
+                                       auto member = current_lobby->GetMember(peer);
+                                       if (member == nullptr) {
+                                           LOG_ERROR("Member not found by peer.");
+                                           return mrb_nil_value();
+                                       }
+
+                                       Unet::PacketType type;
+                                       if (!get_packet_type(rel_type, channel, type)) {
+                                           ERR_INV_PACKET
+                                           return mrb_nil_value();
+                                       }
+
+                                       send_snapshot(mrb, data, channel, type, { member });
+                                       return mrb_nil_value();
+                                   }
+                               }, MRB_ARGS_REQ(2) | MRB_ARGS_OPT(2));
+
+    mrb_define_module_function(state, module, "send_snapshot_to_members", {
+                                   [](mrb_state* mrb, mrb_value self) {
+                                       if (!g_ctx->IsHosting()) {
+                                           push_error("'send_snapshot_to_members' is only available for host!", -1);
+                                           return mrb_nil_value();
+                                       }
+                                       mrb_value data;
+                                       mrb_int channel = 0;
+                                       mrb_sym rel_type = os_unreliable;
+                                       mrb_get_args(mrb, "H|in", &data, &channel, &rel_type);
+                                       auto current_lobby = g_ctx->CurrentLobby();
+                                       if (current_lobby == nullptr) {
+                                           LOG_ERROR("Not in a lobby.");
+                                           return mrb_nil_value();
+                                       }
+
+                                       Unet::PacketType type;
+                                       if (!get_packet_type(rel_type, channel, type)) {
+                                           ERR_INV_PACKET
+                                           return mrb_nil_value();
+                                       }
+
+                                       std::vector<Unet::LobbyMember*> members;
+                                       for (auto member : current_lobby->GetMembers()) {
+                                           if (member->UnetPeer != g_ctx->GetLocalPeer()) {
+                                               members.push_back(member);
+                                           }
+                                       }
+
+                                       send_snapshot(mrb, data, channel, type, members);
                                        return mrb_nil_value();
                                    }
                                }, MRB_ARGS_REQ(1) | MRB_ARGS_OPT(2));
@@ -1044,6 +2014,41 @@ void register_ruby_calls(mrb_state* state, RClass* module) {
 mrb_value steam_init_api_m(mrb_state* state, mrb_value self) {
     update_state = state;
 
+    mrb_int num_channels = 1;
+    mrb_value channel_types = mrb_nil_value();
+    mrb_get_args(state, "|io", &num_channels, &channel_types);
+
+    if (num_channels < 1 || num_channels > MAX_CHANNELS) {
+        LOG_ERROR("Channel count has to be between 1 and " + std::to_string(MAX_CHANNELS) + ".");
+        num_channels = num_channels < 1 ? 1 : MAX_CHANNELS;
+    }
+    g_numChannels = (int)num_channels;
+    g_channelPacketTypes.assign(g_numChannels, Unet::PacketType::Reliable);
+
+    // Optional hash of channel => packet type symbol (:os_reliable, :os_unreliable, ...), for sends on that channel
+    // that don't specify one
+    if (mrb_type(channel_types) == MRB_TT_HASH) {
+        auto keys = mrb_hash_keys(state, channel_types);
+        auto num_keys = RARRAY_LEN(keys);
+        for (mrb_int i = 0; i < num_keys; i++) {
+            auto key = RARRAY_PTR(keys)[i];
+            auto value = mrb_hash_get(state, channel_types, key);
+            Unet::PacketType type;
+            if (mrb_type(key) != MRB_TT_INTEGER || mrb_type(value) != MRB_TT_SYMBOL ||
+                !get_packet_type(mrb_symbol(value), -1, type)) {
+                LOG_ERROR("Channel defaults have to map channel numbers to packet types.");
+                continue;
+            }
+
+            auto channel = mrb_integer(key);
+            if (channel < 0 || channel >= num_channels) {
+                LOG_ERROR("Channel " + std::to_string(channel) + " is out of range.");
+                continue;
+            }
+            g_channelPacketTypes[channel] = type;
+        }
+    }
+
     auto str = get_argv(state);
     use_steam = !regexContains(str, "--nosteam");
     use_enet = !regexContains(str, "--noenet");
@@ -1075,8 +2080,16 @@ void register_symbols(mrb_state* state) {
 
     REGISTER_SYMBOL(os_reliable)
     REGISTER_SYMBOL(os_unreliable)
+    REGISTER_SYMBOL(os_unsequenced)
+    REGISTER_SYMBOL(os_unreliable_fragment)
+    REGISTER_SYMBOL(os_latest_only)
+
+    REGISTER_SYMBOL(os_fifo)
+    REGISTER_SYMBOL(os_drop_oldest)
+    REGISTER_SYMBOL(os_latest_per_peer)
 
     REGISTER_SYMBOL(on_data_received)
+    REGISTER_SYMBOL(on_data_batch_received)
     REGISTER_SYMBOL(on_lobby_data_changed)
     REGISTER_SYMBOL(on_lobby_self_joined)
     REGISTER_SYMBOL(on_lobby_self_left)
@@ -1133,7 +2146,7 @@ void drb_register_c_extensions_with_api(mrb_state* state, drb_api_t* api) {
     exception_serialization = mrb_class_get_under(state, steam, "InvalidPacketTypeError");
     exception_deserialization = mrb_class_get_under(state, steam, "InvalidVisibilityError");
 
-    mrb_define_module_function(state, steam, "init_api", steam_init_api_m, MRB_ARGS_NONE());
+    mrb_define_module_function(state, steam, "init_api", steam_init_api_m, MRB_ARGS_OPT(2));
     register_symbols(state);
     printf("* INFO: C extension 'OService' registration completed.\n");
 }
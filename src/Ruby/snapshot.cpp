@@ -0,0 +1,231 @@
+#include "snapshot.h"
+#include <cstring>
+
+// Encoded snapshots look like this, with all integers being 32 bit little endian:
+//   [snapshot] [baseline] [num changed] ([key size] [key] [value size] [value])... [num removed] ([key size] [key])...
+
+static void write_u32_be(std::string& out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back((char)(uint8_t)(value >> shift));
+    }
+}
+
+static uint32_t read_u32_be(const char* p) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value = (value << 8) | (uint8_t)p[i];
+    }
+    return value;
+}
+
+void append_snapshot_path(std::string& path, SnapshotPathKind kind, const std::string& bytes) {
+    path.push_back(kind);
+    write_u32_be(path, (uint32_t)bytes.size());
+    path += bytes;
+}
+
+void append_snapshot_index(std::string& path, uint32_t index) {
+    path.push_back(SNAPSHOT_PATH_INDEX);
+    write_u32_be(path, 4);
+    write_u32_be(path, index);
+}
+
+bool read_snapshot_path(const std::string& path, size_t& offset, SnapshotPathKind& kind, std::string& bytes) {
+    if (path.size() - offset < 5) {
+        return false;
+    }
+    kind = (SnapshotPathKind)path[offset];
+    uint32_t size = read_u32_be(path.data() + offset + 1);
+    if (path.size() - offset - 5 < size) {
+        return false;
+    }
+    bytes.assign(path, offset + 5, size);
+    offset += 5 + size;
+    return true;
+}
+
+bool read_snapshot_index(const std::string& bytes, uint32_t& index) {
+    if (bytes.size() != 4) {
+        return false;
+    }
+    index = read_u32_be(bytes.data());
+    return true;
+}
+
+static void store_u32(uint8_t* p, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t)(value >> (i * 8));
+    }
+}
+
+static void write_u32(std::vector<uint8_t>& out, uint32_t value) {
+    out.resize(out.size() + 4);
+    store_u32(out.data() + out.size() - 4, value);
+}
+
+static void write_string(std::vector<uint8_t>& out, const std::string& str) {
+    write_u32(out, (uint32_t)str.size());
+    out.insert(out.end(), str.begin(), str.end());
+}
+
+static bool read_u32(const uint8_t*& p, const uint8_t* end, uint32_t& value) {
+    if (end - p < 4) {
+        return false;
+    }
+    value = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    p += 4;
+    return true;
+}
+
+static bool read_string(const uint8_t*& p, const uint8_t* end, std::string& str) {
+    uint32_t size;
+    if (!read_u32(p, end, size) || (size_t)(end - p) < size) {
+        return false;
+    }
+    str.assign((const char*)p, size);
+    p += size;
+    return true;
+}
+
+uint32_t SnapshotSender::push(SnapshotState&& state) {
+    sequence++;
+    history[sequence] = std::move(state);
+    while (history.size() > SNAPSHOT_HISTORY_SIZE) {
+        history.erase(history.begin());
+    }
+    return sequence;
+}
+
+uint32_t SnapshotSender::get_baseline(int peer) const {
+    auto it = acknowledged.find(peer);
+    if (it == acknowledged.end() || history.find(it->second) == history.end()) {
+        return 0;
+    }
+    return it->second;
+}
+
+void SnapshotSender::encode(uint32_t snapshot, uint32_t baseline, std::vector<uint8_t>& out) const {
+    static const SnapshotState empty_state;
+
+    auto& state = history.at(snapshot);
+    auto it_baseline = history.find(baseline);
+    auto& base = it_baseline == history.end() ? empty_state : it_baseline->second;
+
+    out.clear();
+    write_u32(out, snapshot);
+    write_u32(out, it_baseline == history.end() ? 0 : baseline);
+
+    // Both states are sorted by key, so the changes can be found by walking them side by side
+    size_t num_changed_pos = out.size();
+    uint32_t num_changed = 0;
+    write_u32(out, 0);
+
+    std::vector<const std::string*> removed;
+
+    auto it = state.begin();
+    auto it_base = base.begin();
+    while (it != state.end() || it_base != base.end()) {
+        if (it_base == base.end() || (it != state.end() && it->first < it_base->first)) {
+            write_string(out, it->first);
+            write_string(out, it->second);
+            num_changed++;
+            ++it;
+        } else if (it == state.end() || it_base->first < it->first) {
+            removed.push_back(&it_base->first);
+            ++it_base;
+        } else {
+            if (it->second != it_base->second) {
+                write_string(out, it->first);
+                write_string(out, it->second);
+                num_changed++;
+            }
+            ++it;
+            ++it_base;
+        }
+    }
+
+    store_u32(out.data() + num_changed_pos, num_changed);
+
+    write_u32(out, (uint32_t)removed.size());
+    for (auto key : removed) {
+        write_string(out, *key);
+    }
+}
+
+void SnapshotSender::acknowledge(int peer, uint32_t snapshot) {
+    auto& current = acknowledged[peer];
+    if (snapshot > current && snapshot <= sequence) {
+        current = snapshot;
+    }
+}
+
+void SnapshotSender::remove_peer(int peer) {
+    acknowledged.erase(peer);
+}
+
+bool SnapshotReceiver::decode(const uint8_t* data, size_t size, uint32_t& out_snapshot) {
+    const uint8_t* p = data;
+    const uint8_t* end = data + size;
+
+    uint32_t snapshot, baseline;
+    if (!read_u32(p, end, snapshot) || !read_u32(p, end, baseline)) {
+        return false;
+    }
+
+    // Unreliable snapshots can arrive out of order, older ones are of no use anymore
+    if (snapshot <= latest) {
+        return false;
+    }
+
+    SnapshotState state;
+    if (baseline != 0) {
+        auto it = baselines.find(baseline);
+        if (it == baselines.end()) {
+            return false;
+        }
+        state = it->second;
+    }
+
+    uint32_t num_changed;
+    if (!read_u32(p, end, num_changed)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < num_changed; i++) {
+        std::string key, value;
+        if (!read_string(p, end, key) || !read_string(p, end, value)) {
+            return false;
+        }
+        state[std::move(key)] = std::move(value);
+    }
+
+    uint32_t num_removed;
+    if (!read_u32(p, end, num_removed)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < num_removed; i++) {
+        std::string key;
+        if (!read_string(p, end, key)) {
+            return false;
+        }
+        state.erase(key);
+    }
+
+    latest = snapshot;
+    baselines[snapshot] = std::move(state);
+    while (baselines.size() > SNAPSHOT_HISTORY_SIZE) {
+        baselines.erase(baselines.begin());
+    }
+
+    out_snapshot = snapshot;
+    return true;
+}
+
+const SnapshotState& SnapshotReceiver::get_latest() const {
+    static const SnapshotState empty_state;
+
+    auto it = baselines.find(latest);
+    if (it == baselines.end()) {
+        return empty_state;
+    }
+    return it->second;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Path -> value of every entry of a snapshot. Nested hashes and arrays get an entry of their own, and so does
+// each of their elements, so a delta only contains the nested keys and array elements that changed.
+typedef std::map<std::string, std::string> SnapshotState;
+
+// A path is made of one component per level, each being [kind] [size] [bytes] with the size as a 32 bit big
+// endian integer. A parent always sorts right before its children this way, and array elements sort by index.
+enum SnapshotPathKind : char {
+    // The bytes are the serialized hash key
+    SNAPSHOT_PATH_KEY = 'k',
+    // The bytes are the array index as a 32 bit big endian integer
+    SNAPSHOT_PATH_INDEX = 'i',
+};
+
+// Values start with their kind. Only plain values are followed by their serialized form.
+enum SnapshotValueKind : char {
+    SNAPSHOT_VALUE = 'v',
+    SNAPSHOT_HASH = 'h',
+    SNAPSHOT_ARRAY = 'a',
+};
+
+void append_snapshot_path(std::string& path, SnapshotPathKind kind, const std::string& bytes);
+void append_snapshot_index(std::string& path, uint32_t index);
+// Reads the path component at offset and moves past it. Returns false if the path is malformed.
+bool read_snapshot_path(const std::string& path, size_t& offset, SnapshotPathKind& kind, std::string& bytes);
+bool read_snapshot_index(const std::string& bytes, uint32_t& index);
+
+// Amount of sent snapshots (and received baselines) to keep around. If a peer's last acknowledged snapshot is
+// older than this, it gets a full snapshot again.
+constexpr size_t SNAPSHOT_HISTORY_SIZE = 32;
+
+// Keeps the snapshots that were sent on a channel, and the last snapshot every peer has acknowledged, so that
+// each peer only gets the entries that changed since a snapshot it is known to have.
+class SnapshotSender {
+private:
+    uint32_t sequence = 0;
+    std::map<uint32_t, SnapshotState> history;
+    std::unordered_map<int, uint32_t> acknowledged;
+
+public:
+    // Stores the state as the next snapshot and returns its sequence number.
+    uint32_t push(SnapshotState&& state);
+    // Returns the snapshot the peer has acknowledged if it's still known, or 0 if it needs a full snapshot.
+    uint32_t get_baseline(int peer) const;
+    // Encodes the given snapshot as a delta against the baseline (0 for a full snapshot).
+    void encode(uint32_t snapshot, uint32_t baseline, std::vector<uint8_t>& out) const;
+
+    void acknowledge(int peer, uint32_t snapshot);
+    void remove_peer(int peer);
+};
+
+// Keeps the snapshots received from a single peer on a channel, to apply deltas to.
+class SnapshotReceiver {
+private:
+    uint32_t latest = 0;
+    std::map<uint32_t, SnapshotState> baselines;
+
+public:
+    // Applies an encoded snapshot. Returns false if it's malformed, older than the latest one, or based on a
+    // snapshot we don't have.
+    bool decode(const uint8_t* data, size_t size, uint32_t& out_snapshot);
+    const SnapshotState& get_latest() const;
+};
@@ -10,8 +10,16 @@ inline mrb_sym os_client;
 
 inline mrb_sym os_reliable;
 inline mrb_sym os_unreliable;
+inline mrb_sym os_unsequenced;
+inline mrb_sym os_unreliable_fragment;
+inline mrb_sym os_latest_only;
+
+inline mrb_sym os_fifo;
+inline mrb_sym os_drop_oldest;
+inline mrb_sym os_latest_per_peer;
 
 inline mrb_sym on_data_received;
+inline mrb_sym on_data_batch_received;
 inline mrb_sym on_lobby_data_changed;
 inline mrb_sym on_lobby_self_joined;
 inline mrb_sym on_lobby_self_left;
@@ -6,3 +6,27 @@ Unet::Service::Service(Internal::Context* ctx, int numChannels)
 	m_ctx = ctx;
 	m_numChannels = numChannels;
 }
+
+void Unet::Service::SendPacketToMany(const std::vector<ServiceID> &peerIds, const void* data, size_t size, PacketType type, uint8_t channel)
+{
+	for (auto &id : peerIds) {
+		SendPacket(id, data, size, type, channel);
+	}
+}
+
+Unet::NetworkMessage* Unet::Service::ReadMessage(MessagePool* pool, uint8_t channel)
+{
+	size_t packetSize;
+	if (!IsPacketAvailable(&packetSize, channel)) {
+		return nullptr;
+	}
+
+	auto ret = pool->AllocMessage(packetSize);
+	ret->m_size = ReadPacket(ret->m_data, packetSize, &ret->m_peer, channel);
+	return ret;
+}
+
+void Unet::Service::ForwardMessage(const ServiceID &peerId, NetworkMessage* msg, PacketType type, uint8_t channel)
+{
+	SendPacket(peerId, msg->m_data, msg->m_size, type, channel);
+}
@@ -73,8 +73,8 @@ Unet::ServiceEnet::~ServiceEnet()
 
 void Unet::ServiceEnet::SimulateOutage()
 {
-	for (auto peer : m_peers) {
-		enet_peer_disconnect_now(peer, 0);
+	for (auto &pair : m_peers) {
+		enet_peer_disconnect_now(pair.second, 0);
 	}
 	m_peers.clear();
 
@@ -86,6 +86,15 @@ void Unet::ServiceEnet::SimulateOutage()
 	m_peerHost = nullptr;
 }
 
+void Unet::ServiceEnet::Flush()
+{
+	// enet_host_service only runs at the start of RunCallbacks, so anything sent after it would otherwise sit in
+	// the queue for a frame
+	if (m_host != nullptr) {
+		enet_host_flush(m_host);
+	}
+}
+
 void Unet::ServiceEnet::RunCallbacks()
 {
 	if (m_host != nullptr && m_waitingForPeers) {
@@ -112,7 +121,10 @@ void Unet::ServiceEnet::RunCallbacks()
 				m_ctx->GetCallbacks()->OnLogDebug(strPrintF("[Enet] Connecting to client 0x%016llX", id.ID));
 
 				auto addr = IDToAddress(id);
-				m_peers.emplace_back(enet_host_connect(m_host, &addr, m_channels.size(), 0));
+				auto peer = enet_host_connect(m_host, &addr, m_channels.size(), 0);
+				if (peer != nullptr) {
+					AddPeer(peer);
+				}
 			}
 		}
 	}
@@ -134,10 +146,7 @@ void Unet::ServiceEnet::RunCallbacks()
 			} else {
 				m_ctx->GetCallbacks()->OnLogDebug(strPrintF("[Enet] Client connected: 0x%016llX", AddressToInt(ev.peer->address)));
 
-				auto it = std::find(m_peers.begin(), m_peers.end(), ev.peer);
-				if (it == m_peers.end()) {
-					m_peers.emplace_back(ev.peer);
-				}
+				AddPeer(ev.peer);
 			}
 
 		} else if (ev.type == ENET_EVENT_TYPE_DISCONNECT) {
@@ -152,11 +161,8 @@ void Unet::ServiceEnet::RunCallbacks()
 			} else {
 				m_ctx->GetCallbacks()->OnLogDebug(strPrintF("[Enet] Client disconnected: 0x%016llX", AddressToInt(ev.peer->address)));
 
-				auto it = std::find(m_peers.begin(), m_peers.end(), ev.peer);
-				if (it == m_peers.end()) {
+				if (!RemovePeer(ev.peer)) {
 					m_ctx->GetCallbacks()->OnLogWarn("[Enet] Couldn't find peer in list of connected peers!");
-				} else {
-					m_peers.erase(it);
 				}
 
 				auto currentLobby = m_ctx->CurrentLobby();
@@ -168,8 +174,8 @@ void Unet::ServiceEnet::RunCallbacks()
 				if (ev.peer == m_peerHost) {
 					m_ctx->GetCallbacks()->OnLogDebug("[Enet] Disconnected from host!");
 
-					for (auto peer : m_peers) {
-						enet_peer_disconnect_now(peer, 0);
+					for (auto &pair : m_peers) {
+						enet_peer_disconnect_now(pair.second, 0);
 					}
 					m_peers.clear();
 
@@ -221,7 +227,7 @@ void Unet::ServiceEnet::CreateLobby(LobbyPrivacy privacy, int maxPlayers, LobbyI
 	addr.host = ENET_HOST_ANY;
 	addr.port = enet_default_port;
 
-	size_t maxChannels = m_numChannels + 2;
+	size_t maxChannels = m_numChannels + 3;
 
 	Clear(maxChannels);
 
@@ -311,7 +317,7 @@ void Unet::ServiceEnet::JoinLobby(const ServiceID &id)
 
 	auto addr = IDToAddress(id);
 	size_t maxPeers = 128; //TODO: Make this customizable
-	size_t maxChannels = m_numChannels + 2;
+	size_t maxChannels = m_numChannels + 3;
 
 	Clear(maxChannels);
 
@@ -325,7 +331,9 @@ void Unet::ServiceEnet::JoinLobby(const ServiceID &id)
 	m_peerHost = enet_host_connect(m_host, &addr, maxChannels, 0);
 
 	m_peers.clear();
-	m_peers.emplace_back(m_peerHost);
+	if (m_peerHost != nullptr) {
+		AddPeer(m_peerHost);
+	}
 
 	m_waitingForPeers = true;
 }
@@ -405,6 +413,24 @@ size_t Unet::ServiceEnet::ReliablePacketLimit()
 	return 0;
 }
 
+bool Unet::ServiceEnet::GetConnectionStatus(const ServiceID &peerId, ConnectionStatus &status)
+{
+	auto peer = GetPeer(peerId);
+	if (peer == nullptr) {
+		return false;
+	}
+
+	// Reliable commands wait in this list until they fit in the peer's window, after which they count as in transit
+	size_t queued = 0;
+	for (auto it = enet_list_begin(&peer->outgoingSendReliableCommands); it != enet_list_end(&peer->outgoingSendReliableCommands); it = enet_list_next(it)) {
+		queued += ((ENetOutgoingCommand*)it)->fragmentLength;
+	}
+
+	status.PendingReliableBytes = peer->reliableDataInTransit + queued;
+	status.RoundTripTime = peer->roundTripTime;
+	return true;
+}
+
 void Unet::ServiceEnet::SendPacket(const ServiceID &peerId, const void* data, size_t size, PacketType type, uint8_t channel)
 {
 	auto peer = GetPeer(peerId);
@@ -413,14 +439,27 @@ void Unet::ServiceEnet::SendPacket(const ServiceID &peerId, const void* data, si
 		return;
 	}
 
-	enet_uint32 flags = ENET_PACKET_FLAG_RELIABLE;
-	switch (type) {
-	case PacketType::Reliable: flags = ENET_PACKET_FLAG_RELIABLE; break;
-	case PacketType::Unreliable: flags = 0; break;
+	auto packet = enet_packet_create(data, size, GetPacketFlags(type));
+	enet_peer_send(peer, channel, packet);
+}
+
+void Unet::ServiceEnet::SendPacketToMany(const std::vector<ServiceID> &peerIds, const void* data, size_t size, PacketType type, uint8_t channel)
+{
+	// ENet packets are reference counted, so all peers can share the same packet
+	auto packet = enet_packet_create(data, size, GetPacketFlags(type));
+
+	for (auto &id : peerIds) {
+		auto peer = GetPeer(id);
+		if (peer == nullptr) {
+			m_ctx->GetCallbacks()->OnLogWarn(strPrintF("[Enet] Tried sending packet of %d bytes to unidentified peer 0x%016llX on channel %d", (int)size, id.ID, (int)channel));
+			continue;
+		}
+		enet_peer_send(peer, channel, packet);
 	}
 
-	auto packet = enet_packet_create(data, size, flags);
-	enet_peer_send(peer, channel, packet);
+	if (packet->referenceCount == 0) {
+		enet_packet_destroy(packet);
+	}
 }
 
 size_t Unet::ServiceEnet::ReadPacket(void* data, size_t maxSize, ServiceID* peerId, uint8_t channel)
@@ -437,11 +476,7 @@ size_t Unet::ServiceEnet::ReadPacket(void* data, size_t maxSize, ServiceID* peer
 	memcpy(data, packet.Packet->data, actualSize);
 
 	if (peerId != nullptr) {
-		if (packet.Peer == m_peerHost) {
-			*peerId = ServiceID(ServiceType::Enet, 0);
-		} else {
-			*peerId = AddressToID(packet.Peer->address);
-		}
+		*peerId = GetPacketPeerID(packet);
 	}
 
 	enet_packet_destroy(packet.Packet);
@@ -450,6 +485,50 @@ size_t Unet::ServiceEnet::ReadPacket(void* data, size_t maxSize, ServiceID* peer
 	return actualSize;
 }
 
+static void ReleaseBorrowedPacket(void* handle)
+{
+	// If the packet was forwarded to other peers, ENet still holds references to it and will destroy it itself
+	auto packet = (ENetPacket*)handle;
+	if (packet->referenceCount == 0) {
+		enet_packet_destroy(packet);
+	}
+}
+
+Unet::NetworkMessage* Unet::ServiceEnet::ReadMessage(MessagePool* pool, uint8_t channel)
+{
+	if (!IsPacketAvailable(nullptr, channel)) {
+		return nullptr;
+	}
+
+	auto &queue = m_channels[channel];
+	auto packet = queue.front();
+	queue.pop();
+
+	// The message takes ownership of the packet, so its data doesn't have to be copied
+	auto ret = pool->AllocBorrowedMessage(packet.Packet->data, packet.Packet->dataLength, &ReleaseBorrowedPacket, packet.Packet);
+	ret->m_peer = GetPacketPeerID(packet);
+	return ret;
+}
+
+void Unet::ServiceEnet::ForwardMessage(const ServiceID &peerId, NetworkMessage* msg, PacketType type, uint8_t channel)
+{
+	auto packet = (ENetPacket*)msg->m_borrowHandle;
+	if (msg->m_borrowRelease != &ReleaseBorrowedPacket || packet->data != msg->m_data || packet->dataLength != msg->m_size) {
+		SendPacket(peerId, msg->m_data, msg->m_size, type, channel);
+		return;
+	}
+
+	auto peer = GetPeer(peerId);
+	if (peer == nullptr) {
+		m_ctx->GetCallbacks()->OnLogWarn(strPrintF("[Enet] Tried forwarding packet of %d bytes to unidentified peer 0x%016llX on channel %d", (int)msg->m_size, peerId.ID, (int)channel));
+		return;
+	}
+
+	// Send the received packet as-is, ENet takes a reference to it so it outlives the message
+	packet->flags = GetPacketFlags(type);
+	enet_peer_send(peer, channel, packet);
+}
+
 bool Unet::ServiceEnet::IsPacketAvailable(size_t* outPacketSize, uint8_t channel)
 {
 	if (m_host == nullptr) {
@@ -480,12 +559,46 @@ ENetPeer* Unet::ServiceEnet::GetPeer(const ServiceID &id)
 		return m_peerHost;
 	}
 
-	for (auto peer : m_peers) {
-		if (AddressToID(peer->address) == id) {
-			return peer;
-		}
+	auto it = m_peers.find(id.ID);
+	if (it == m_peers.end()) {
+		return nullptr;
+	}
+	return it->second;
+}
+
+void Unet::ServiceEnet::AddPeer(ENetPeer* peer)
+{
+	m_peers[AddressToInt(peer->address)] = peer;
+}
+
+bool Unet::ServiceEnet::RemovePeer(ENetPeer* peer)
+{
+	auto it = m_peers.find(AddressToInt(peer->address));
+	if (it == m_peers.end() || it->second != peer) {
+		return false;
+	}
+	m_peers.erase(it);
+	return true;
+}
+
+enet_uint32 Unet::ServiceEnet::GetPacketFlags(PacketType type)
+{
+	switch (type) {
+	case PacketType::Reliable: return ENET_PACKET_FLAG_RELIABLE;
+	case PacketType::Unreliable: return 0;
+	case PacketType::Unsequenced: return ENET_PACKET_FLAG_UNSEQUENCED;
+	case PacketType::UnreliableFragment: return ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT;
+	case PacketType::LatestOnly: return 0;
+	}
+	return ENET_PACKET_FLAG_RELIABLE;
+}
+
+Unet::ServiceID Unet::ServiceEnet::GetPacketPeerID(const EnetPacket &packet)
+{
+	if (packet.Peer == m_peerHost) {
+		return ServiceID(ServiceType::Enet, 0);
 	}
-	return nullptr;
+	return AddressToID(packet.Peer->address);
 }
 
 void Unet::ServiceEnet::Clear(size_t numChannels)
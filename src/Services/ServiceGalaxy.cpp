@@ -325,6 +325,9 @@ void Unet::ServiceGalaxy::SendPacket(const ServiceID &peerId, const void* data,
 	switch (type) {
 	case PacketType::Unreliable: sendType = galaxy::api::P2P_SEND_UNRELIABLE; break;
 	case PacketType::Reliable: sendType = galaxy::api::P2P_SEND_RELIABLE; break;
+	case PacketType::Unsequenced: sendType = galaxy::api::P2P_SEND_UNRELIABLE_IMMEDIATE; break;
+	case PacketType::UnreliableFragment: sendType = galaxy::api::P2P_SEND_UNRELIABLE; break;
+	case PacketType::LatestOnly: sendType = galaxy::api::P2P_SEND_UNRELIABLE; break;
 	}
 	galaxy::api::Networking()->SendP2PPacket(peerId.ID, data, (uint32_t)size, sendType, channel);
 }
@@ -262,6 +262,21 @@ size_t Unet::ServiceSteam::ReliablePacketLimit()
 	return 1200; //max MTU size //1024 * 1024;
 }
 
+bool Unet::ServiceSteam::GetConnectionStatus(const ServiceID &peerId, ConnectionStatus &status)
+{
+	assert(peerId.Service == ServiceType::Steam);
+
+	// Steam doesn't tell us the round trip time, and counts unreliable data as well
+	P2PSessionState_t state;
+	if (!SteamNetworking()->GetP2PSessionState((uint64)peerId.ID, &state) || !state.m_bConnectionActive) {
+		return false;
+	}
+
+	status.PendingReliableBytes = (size_t)state.m_nBytesQueuedForSend;
+	status.RoundTripTime = 0;
+	return true;
+}
+
 void Unet::ServiceSteam::SendPacket(const ServiceID &peerId, const void* data, size_t size, PacketType type, uint8_t channel)
 {
 	assert(peerId.Service == ServiceType::Steam);
@@ -270,6 +285,9 @@ void Unet::ServiceSteam::SendPacket(const ServiceID &peerId, const void* data, s
 	switch (type) {
 	case PacketType::Unreliable: sendType = k_EP2PSendUnreliable; break;
 	case PacketType::Reliable: sendType = k_EP2PSendReliable; break;
+	case PacketType::Unsequenced: sendType = k_EP2PSendUnreliable; break;
+	case PacketType::UnreliableFragment: sendType = k_EP2PSendUnreliable; break;
+	case PacketType::LatestOnly: sendType = k_EP2PSendUnreliable; break;
 	}
 	SteamNetworking()->SendP2PPacket((uint64)peerId.ID, data, (uint32)size, sendType, (int)channel);
 }